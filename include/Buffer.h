@@ -54,6 +54,11 @@ public:
     /// @param value The new value for the property "recyclable"
     void recyclable(bool value);
 
+    /// Get the size of the data held by the buffer (it is used to measure the load of the work manager)
+    ///
+    /// @return The data size in bytes (0 by default)
+    virtual int datasize() const;
+
 protected:
 
     bool m_recyclable;
@@ -35,12 +35,53 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "IoBuffer.h"
 #include "BufferManager.h"
 
+#ifndef ESN_IOBUF_MIN_CLASS_SIZE
+#define ESN_IOBUF_MIN_CLASS_SIZE 256
+#endif
+
+#ifndef ESN_IOBUF_MAX_CLASS_SIZE
+#define ESN_IOBUF_MAX_CLASS_SIZE (1024 * 1024)
+#endif
+
+#ifndef ESN_IOBUF_MAGAZINE_SIZE
+#define ESN_IOBUF_MAGAZINE_SIZE 32
+#endif
+
+#ifndef ESN_IOBUF_MAGAZINE_BYTES
+#define ESN_IOBUF_MAGAZINE_BYTES (256 * 1024)
+#endif
+
+#ifndef ESN_IOBUF_TRIM_INTERVAL
+#define ESN_IOBUF_TRIM_INTERVAL 1000
+#endif
+
 namespace esnlib
 {
 /// IO Buffer Manager, it will work like a memory pool
+///
+/// The buffers are kept by size classes (powers of two, from ESN_IOBUF_MIN_CLASS_SIZE to ESN_IOBUF_MAX_CLASS_SIZE),
+/// a request will be served by the smallest class which can hold it,
+/// and a request larger than the biggest class will go to the allocator directly (the buffer will not be recycled).
+///
+/// Every thread keeps a small cache (magazine) of free buffers for each size class,
+/// and only moves buffers between its cache and the shared pool in batches (with one lock).
+///
+/// The memory of the pool can be bounded by a budget (all bytes allocated by the pool)
+/// and a high watermark (free bytes kept by the pool), and free buffers idle for too long can be trimmed.
 class IoBufferManager : public BufferManager
 {
 public:
+
+    enum
+    {
+        STAT_HITS = 1,                   // how many requests got a free buffer from the pool
+        STAT_MISSES = 2,                 // how many requests had to allocate a new buffer
+        STAT_TOTAL_BYTES = 3,            // bytes of all live buffers allocated by the pool (in use and free)
+        STAT_FREE_BYTES = 4,             // bytes of the free buffers kept by the pool
+        STAT_OUTSTANDING_BYTES = 5,      // bytes of the buffers in use (total - free)
+        STAT_PEAK_OUTSTANDING_BYTES = 6  // the peak of the outstanding bytes
+    };
+
     IoBufferManager();
     virtual ~IoBufferManager();
 
@@ -60,11 +101,56 @@ public:
     /// @return The pointer of the free IO buffer
     virtual IoBufferPtr GetFreeBuffer(int bufsize) = 0;
 
-    /// Take the IO buffer back to the pool
+    /// Take the IO buffer back to the pool (a buffer which is not got from this pool will not be kept)
     ///
     /// @param buf The pointer of the IO buffer
     virtual void TakeBack(IoBufferPtr buf) = 0;
 
+    /// Allocate free buffers in advance for the size class which can hold the specific size
+    ///
+    /// @param bufsize The buffer size (it decides the size class)
+    /// @param itemcount How many free buffers the size class should have at least
+    /// @return The number of the free buffers in the size class
+    virtual int Preallocate(int bufsize, int itemcount) = 0;
+
+    /// Get the memory limit of the pool
+    ///
+    /// @param limittype The limit type: 1 for the budget (max total bytes), 2 for the high watermark (max free bytes)
+    /// @return The limit value (0 means no limit)
+    virtual long long GetMemoryLimit(int limittype) = 0;
+
+    /// Set the memory limit of the pool
+    ///
+    /// When the budget is reached, free buffers (including the ones cached by current thread) will be trimmed first,
+    /// and then the request will fail (get an empty pointer).
+    /// When the high watermark is reached, the buffers taken back will be released instead of being kept.
+    ///
+    /// @param limittype The limit type: 1 for the budget (max total bytes), 2 for the high watermark (max free bytes)
+    /// @param value The limit value (0 means no limit)
+    virtual void SetMemoryLimit(int limittype, long long value) = 0;
+
+    /// Get the idle timeout of free buffers
+    ///
+    /// @return The idle timeout in seconds (0 means never)
+    virtual int GetIdleTimeout() = 0;
+
+    /// Set the idle timeout of free buffers, a background thread will release the free buffers idle for longer than that
+    ///
+    /// @param seconds The idle timeout in seconds (0 means never)
+    virtual void SetIdleTimeout(int seconds) = 0;
+
+    /// Release the free buffers in the shared pool which have been idle for some time (thread caches are not included)
+    ///
+    /// @param idleseconds How long the buffers have been idle at least (in seconds)
+    /// @return How many bytes have been released
+    virtual long long Trim(int idleseconds) = 0;
+
+    /// Get the statistics of the pool
+    ///
+    /// @param stattype The statistics type: STAT_HITS, STAT_MISSES, STAT_TOTAL_BYTES, STAT_FREE_BYTES, STAT_OUTSTANDING_BYTES or STAT_PEAK_OUTSTANDING_BYTES
+    /// @return The statistics value
+    virtual long long GetStatistics(int stattype) = 0;
+
 protected:
 private:
 };
@@ -78,6 +164,9 @@ typedef boost::shared_ptr<IoBufferManager> IoBufferManagerPtr;
 
 /// Create a buffer pool with initial number of the buffers and the default size of every buffer
 ///
+/// The initial buffers are allocated for the size class of the default size only,
+/// use Preallocate() for other size classes.
+///
 /// @param itemcount The initial number of the buffers
 /// @param bufsize The default size of every buffer
 /// @return The pointer of the buffer pool
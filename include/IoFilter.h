@@ -32,8 +32,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef _ESN_IOFILTER_H_
 #define _ESN_IOFILTER_H_
 
+#include <string>
 #include <vector>
 
+#include "Business.h"
 #include "Session.h"
 #include "IoBuffer.h"
 
@@ -48,6 +50,10 @@ public:
 
     /// Extract useful data from the incoming bytes
     ///
+    /// The incoming bytes are a slice of the session's receive block,
+    /// so the useful data can be extracted as slices of it too (see CreateIoBufferSlice()).
+    /// The bytes which are not consumed (after the read position) will be kept for next round.
+    ///
     /// @param session Current session
     /// @param data The pointer of the incoming bytes
     /// @param readylist The list used to save the useful data extracted
@@ -61,15 +67,60 @@ public:
     /// @return The pointer of the IO buffer encoded
     virtual IoBufferPtr Encode(SessionPtr session, void* data) = 0;
 
+    /// Encode the raw buffer with Encode(), and then finish the IO buffer encoded with FinishEncoding()
+    ///
+    /// The sessions and the filter chains always encode through it, so what FinishEncoding() adds
+    /// (e.g. the checksum of MessageCodec) will not be lost even if a subclass overrides Encode().
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the raw buffer
+    /// @return The pointer of the IO buffer encoded
+    IoBufferPtr EncodeAndFinish(SessionPtr session, void* data);
+
     /// Decode the IO buffer
     ///
+    /// The IO buffer may be a slice, writing within its size is fine,
+    /// but resizing it beyond its size will make it copy its content into its own memory.
+    ///
     /// @param session Current session
     /// @param data The pointer of the IO buffer encoded
     /// @return The original raw buffer (a common pointer)
     virtual void* Decode(SessionPtr session, IoBufferPtr data) = 0;
 
+    /// Assign the state slots of the session to the filter (see GetSessionState())
+    ///
+    /// A filter used alone has slot 0, and a filter chain assigns the slots after its own one to its filters.
+    ///
+    /// @param first The first slot which can be used
+    /// @return The next slot which is not used by the filter
+    virtual int AssignStateSlots(int first);
+
 protected:
+
+    /// Finish the IO buffer returned by Encode() before it is written (see EncodeAndFinish())
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the IO buffer encoded
+    /// @return The pointer of the IO buffer finished (the buffer itself by default)
+    virtual IoBufferPtr FinishEncoding(SessionPtr session, IoBufferPtr data);
+
+    /// Get the state of the filter kept in the session (every filter has its own state slot in every session)
+    ///
+    /// Please do not call it when the local data of the session is being held (see Session::GetData()).
+    ///
+    /// @param session Current session
+    /// @return The pointer of the state (empty if it is not set yet)
+    BusinessPtr GetSessionState(SessionPtr session);
+
+    /// Set the state of the filter kept in the session (it will be released with the session)
+    ///
+    /// @param session Current session
+    /// @param state The pointer of the state
+    void SetSessionState(SessionPtr session, BusinessPtr state);
+
 private:
+
+    int m_stateslot;
 };
 
 typedef boost::shared_ptr<IoFilter> IoFilterPtr;
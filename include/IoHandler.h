@@ -56,6 +56,29 @@ public:
     /// @return The flags of the event processing: 1 = async, 2 = concurrent, 3 = both 1 and 2
     virtual int OnRead(SessionPtr session, IoBufferPtr data) = 0;
 
+    /// The callback function for the Read event with a batch of messages (all the useful data read in one round, in order)
+    ///
+    /// The handler can take the messages from the first one. If the last one taken is processed asynchronously
+    /// without concurrency (like OnRead() returning "1"), please stop there and set "wait" to true,
+    /// then the session will wait for it before passing the rest (the same as OnRead()).
+    /// The rest will be passed to OnRead() one by one. It returns 0 by default (no batch).
+    ///
+    /// @param session Current session
+    /// @param msgs The buffer pointers of the messages
+    /// @param count The number of the messages
+    /// @param wait Set it to true if the session should wait for the last message taken
+    /// @return How many messages (from the first one) have been taken
+    virtual int OnReadBatch(SessionPtr session, IoBufferPtr* msgs, int count, bool& wait);
+
+    /// Check whether the session can go on reading incoming data (it is called after every round of reading)
+    ///
+    /// If it returns false, the session will not read anything more (so the peer will be slowed down by TCP flow control)
+    /// until Session::ResumeRead() is called. It returns true by default.
+    ///
+    /// @param session Current session
+    /// @return Return true if the session can go on reading
+    virtual bool CanRead(SessionPtr session);
+
     /// The callback function for the Write event
     ///
     /// @param session Current session
@@ -63,6 +86,18 @@ public:
     /// @return The flags of the event processing: 1 = async, 2 = concurrent, 3 = both 1 and 2
     virtual int OnWrite(SessionPtr session, IoBufferPtr data) = 0;
 
+    /// The callback function for the WriteBlocked event, the outgoing data queued has reached the high watermark
+    /// (see Session::SetWriteWatermark()), the writers should wait for the Writable event. It does nothing by default.
+    ///
+    /// @param session Current session
+    virtual void OnWriteBlocked(SessionPtr session);
+
+    /// The callback function for the Writable event, the outgoing data queued has fallen below the low watermark
+    /// after the session was blocked. It does nothing by default.
+    ///
+    /// @param session Current session
+    virtual void OnWritable(SessionPtr session);
+
     /// The callback function for the Connect event
     ///
     /// @param session Current session
@@ -48,6 +48,11 @@ public:
         STATE_WAIT_FOR_BODY = 1
     };
 
+    enum
+    {
+        ERROR_BAD_CHECKSUM = -1 // the error code (in OnError() event) of a message whose checksum is wrong
+    };
+
     /// Constructor function
     MessageCodec();
 
@@ -80,6 +85,22 @@ public:
     /// Destructor function
     virtual ~MessageCodec();
 
+    /// Enable checksum (both sides must have the same setting)
+    ///
+    /// A CRC32C checksum (4 bytes, little-endian) of the header and the body will be appended to every message when it is written,
+    /// and it will be verified when the message is extracted (it is not counted in the body size and will not be passed to the handler).
+    /// A message with wrong checksum will be dropped, and an OnError() event (read error, error code: ERROR_BAD_CHECKSUM) will be raised.
+    /// The checksum is appended in FinishEncoding(), so a subclass which overrides Encode() still gets it.
+    /// Please enable it before the codec is used by any session.
+    ///
+    /// @param enabled Whether the checksum is enabled
+    void EnableChecksum(bool enabled = true);
+
+    /// Check whether the checksum is enabled
+    ///
+    /// @return Return true if the checksum is enabled
+    bool HasChecksum();
+
     /// Extract useful data (the message made up of header and body) from the incoming bytes
     ///
     /// @param session Current session
@@ -103,6 +124,14 @@ public:
     virtual void* Decode(SessionPtr session, IoBufferPtr data);
 
 protected:
+
+    /// Append the checksum to the message encoded if it is enabled (see EnableChecksum())
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the message encoded
+    /// @return The pointer of the message with the checksum
+    virtual IoBufferPtr FinishEncoding(SessionPtr session, IoBufferPtr data);
+
 private:
 
     int m_headersize;
@@ -110,6 +139,8 @@ private:
     int m_bodysizelen;
     int m_maxbodysize;
 
+    bool m_checksum;
+
 };
 
 typedef boost::shared_ptr<MessageCodec> MessageCodecPtr;
@@ -0,0 +1,238 @@
+/*
+-----------------------------------------------------------------------------
+This source file is part of "esnetwork" library.
+It is licensed under the terms of the BSD license.
+For the latest info, see http://esnetwork.sourceforge.net
+
+Copyright (c) 2012-2013 Lin Jia Jun (Joe Lam)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _ESN_MESSAGECODECT_H_
+#define _ESN_MESSAGECODECT_H_
+
+#include <cstring>
+
+#include <boost/static_assert.hpp>
+
+#include "IoFilter.h"
+
+namespace esnlib
+{
+
+/// How the body size is stored in the message header
+enum MessageLengthType
+{
+    LENGTH_HOST_ENDIAN = 0,    // fixed bytes, the byte order of current machine (the same as MessageCodec)
+    LENGTH_LITTLE_ENDIAN = 1,  // fixed bytes, little-endian
+    LENGTH_BIG_ENDIAN = 2,     // fixed bytes, big-endian (network byte order)
+    LENGTH_VARINT = 3          // base 128 varint (7 bits per byte, the low group first), takes 1 to LenBytes bytes
+};
+
+/// Read the body size from the message header (fixed bytes)
+template <int LenBytes, int LenType>
+struct MessageLengthReader
+{
+    BOOST_STATIC_ASSERT(LenBytes == 1 || LenBytes == 2 || LenBytes == 4);
+
+    /// Read the value
+    ///
+    /// @param buf Where the value begins
+    /// @param len How many bytes can be read
+    /// @param used How many bytes the value has
+    /// @return The value (-1 if the bytes are not enough)
+    static long long Read(const unsigned char* buf, int len, int& used)
+    {
+        used = LenBytes;
+        if(len < LenBytes) return -1;
+
+        unsigned int value = 0;
+        if(LenType == LENGTH_BIG_ENDIAN)
+        {
+            for(int i=0; i<LenBytes; i++) value = (value << 8) | buf[i];
+        }
+        else if(LenType == LENGTH_LITTLE_ENDIAN)
+        {
+            for(int i=LenBytes-1; i>=0; i--) value = (value << 8) | buf[i];
+        }
+        else
+        {
+            // the same as IoBuffer::GetByte()/GetShort()/GetInt() (signed)
+            if(LenBytes == 1) { char v; memcpy(&v, buf, 1); return v; }
+            else if(LenBytes == 2) { short v; memcpy(&v, buf, 2); return v; }
+            else { int v; memcpy(&v, buf, 4); return v; }
+        }
+        return value;
+    }
+};
+
+/// Read the body size from the message header (varint)
+template <int LenBytes>
+struct MessageLengthReader<LenBytes, LENGTH_VARINT>
+{
+    BOOST_STATIC_ASSERT(LenBytes >= 1 && LenBytes <= 5);
+
+    /// Read the value
+    ///
+    /// @param buf Where the value begins
+    /// @param len How many bytes can be read
+    /// @param used How many bytes the value has
+    /// @return The value (-1 if the bytes are not enough, -2 if the value is broken)
+    static long long Read(const unsigned char* buf, int len, int& used)
+    {
+        long long value = 0;
+        for(int i=0; i<LenBytes; i++)
+        {
+            if(i >= len) return -1;
+            value |= (long long)(buf[i] & 0x7f) << (7 * i);
+            if((buf[i] & 0x80) == 0)
+            {
+                used = i + 1;
+                return value;
+            }
+        }
+        return -2;
+    }
+};
+
+/// Message Codec Filter template, it works like MessageCodec but the header layout is decided at compile time
+///
+/// The message is made up of a header and a body, the body size is stored in the header.
+/// With fixed bytes, the header has HeaderSize bytes and the body size is at LenPos with LenBytes bytes.
+/// With varint, the header is LenPos bytes followed by the varint (so its size changes, HeaderSize is its maximum).
+///
+/// @param HeaderSize The size of the header (the maximum size of it with varint)
+/// @param LenPos Where the body size begins in the header
+/// @param LenBytes How many bytes the body size has (the maximum with varint)
+/// @param LenType How the body size is stored (see MessageLengthType)
+/// @param LenIncludesHeader Whether the value in the header is the size of the whole message (header + body)
+template <int HeaderSize, int LenPos, int LenBytes, int LenType = LENGTH_HOST_ENDIAN, bool LenIncludesHeader = false>
+class MessageCodecT : public IoFilter
+{
+    BOOST_STATIC_ASSERT(HeaderSize >= 1 && LenPos >= 0 && LenPos + LenBytes <= HeaderSize);
+    BOOST_STATIC_ASSERT(LenType != LENGTH_VARINT || LenPos + LenBytes == HeaderSize);
+
+public:
+
+    /// Constructor function
+    ///
+    /// @param maxBodySize The maximum body size
+    explicit MessageCodecT(int maxBodySize = 1024)
+    {
+        m_maxbodysize = maxBodySize;
+        if(m_maxbodysize < 0) m_maxbodysize = 0;
+    }
+
+    /// Destructor function
+    virtual ~MessageCodecT()
+    {
+    }
+
+    /// Extract useful data (the message made up of header and body) from the incoming bytes
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the incoming bytes
+    /// @param readylist The list used to save the useful data extracted
+    /// @return Return true if some useful data has been extracted successfully
+    virtual bool Extract(SessionPtr session, IoBufferPtr data, std::vector<IoBufferPtr>& readylist)
+    {
+        // the same as MessageCodec, a message will be extracted as a slice of the incoming bytes when it is all ready
+
+        const unsigned char* buf = (const unsigned char*)data->data();
+        int size = data->size();
+        int currentpos = data->GetReadPos();
+
+        int total = 0;
+
+        while (size - currentpos > LenPos)
+        {
+            int used = 0;
+            long long value = MessageLengthReader<LenBytes, LenType>::Read(buf + currentpos + LenPos, size - currentpos - LenPos, used);
+            if(value == -1) break; // wait for the rest of the header
+            if(value < -1) return true; // broken header
+
+            int headersize = LenType == LENGTH_VARINT ? LenPos + used : HeaderSize;
+
+            long long bodylen = value;
+            if(LenIncludesHeader) bodylen = value - headersize;
+            if(bodylen < 0) bodylen = 0;
+            if(bodylen > m_maxbodysize) return true;
+
+            if (size - currentpos < headersize + bodylen) break; // wait for the rest of the message
+
+            IoBufferPtr newtask = CreateIoBufferSlice(data, currentpos, headersize + (int)bodylen);
+            readylist.push_back(newtask);
+            total++;
+
+            currentpos += headersize + (int)bodylen;
+        }
+
+        data->SetReadPos(currentpos);
+
+        if (total > 0 && size - currentpos <= 0) return true;
+
+        return false;
+    }
+
+    /// Encode the raw buffer
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the raw buffer (an IO buffer with the whole message)
+    /// @return The pointer of the IO buffer encoded
+    virtual IoBufferPtr Encode(SessionPtr session, void* data)
+    {
+        IoBufferPtr newtask;
+        IoBuffer* buf = (IoBuffer*)data;
+        if(buf && buf->IsSlice())
+        {
+            // a slice can be sent as another slice of the same memory (no copy)
+            newtask = CreateIoBufferSlice(buf->GetSource(), buf->GetOffset(), buf->size());
+            return newtask;
+        }
+        if(buf) newtask = session->GetFreeBuffer(buf->size());
+        if(newtask && buf) newtask->PutBuf(buf->data(), buf->size());
+        return newtask;
+    }
+
+    /// Decode the IO buffer
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the IO buffer encoded
+    /// @return The original raw buffer (a common pointer)
+    virtual void* Decode(SessionPtr session, IoBufferPtr data)
+    {
+        if(data) return (void*)(data.get());
+        else return NULL;
+    }
+
+protected:
+private:
+
+    int m_maxbodysize;
+
+};
+
+}
+
+#endif // _ESN_MESSAGECODECT_H_
@@ -38,6 +38,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace esnlib
 {
 
+class MessageTaskBatch;
+
 /// Common Message Handler class, an event handler who can handle network IO events for common message(format: header + body)
 class MessageHandler : public IoHandler
 {
@@ -70,6 +72,18 @@ public:
     /// @return The DefaultWork (pointer)
     WorkPtr GetDefaultWork();
 
+    /// Check whether the sessions stop reading when they are not writable (see CanRead())
+    ///
+    /// @return Return true if the sessions stop reading when they are not writable
+    bool GetReadPauseOnWriteBlocked();
+
+    /// Set whether the sessions stop reading when they are not writable (see CanRead()), it is off by default.
+    /// It keeps a peer which is not taking the replies from sending more requests,
+    /// but the peers should not both do it if both of them may write a lot without reading
+    ///
+    /// @param value Whether the sessions stop reading when they are not writable
+    void SetReadPauseOnWriteBlocked(bool value);
+
     /// Get the code from the buffer data
     ///
     /// @param data The buffer data
@@ -94,6 +108,26 @@ public:
     /// @return The string key
     virtual std::string GetStrKey(IoBuffer* data);
 
+    /// Get the priority class of the message, which is used when it is processed by the work manager
+    ///
+    /// @param data The buffer data
+    /// @return The priority class (see WorkPriority)
+    virtual int GetPriority(IoBuffer* data);
+
+    /// Get how long the message can wait in the work manager, it will be dropped if it has waited longer
+    /// (see IoWork::HandleExpired())
+    ///
+    /// @param data The buffer data
+    /// @return The timeout in milliseconds (0 means no limit)
+    virtual int GetTaskTimeout(IoBuffer* data);
+
+    /// Get the key of the serial queue for the orderly messages of the session (see WorkManager::AddSerialWorkTask())
+    ///
+    /// @param session Current session
+    /// @param data The message data
+    /// @return The session id, or a key made from the session address if the id has not been set
+    virtual int GetSerialKey(SessionPtr session, IoBuffer* data);
+
     /// Check whether the message is an orderly message
     ///
     /// @param data The message data
@@ -113,6 +147,36 @@ public:
     /// @return The flags of the event processing: 1 = async, 2 = concurrent, 3 = both 1 and 2
     virtual int OnRead(SessionPtr session, IoBufferPtr data);
 
+    /// The callback function for the Read event with a batch of messages
+    ///
+    /// It passes the messages to OnRead() in order, the orderly ones are put into the serial queue of the session,
+    /// so the session does not need to wait for them.
+    /// But if OnRead() (of a subclass) returns "1" without "2", it stops there and lets the session wait for that one.
+    /// The tasks made by OnRead() are added to the work manager together (see WorkManager::AddWorkTasks()).
+    ///
+    /// @param session Current session
+    /// @param msgs The buffer pointers of the messages
+    /// @param count The number of the messages
+    /// @param wait It will be set to true if the session should wait for the last message taken
+    /// @return How many messages (from the first one) have been taken
+    virtual int OnReadBatch(SessionPtr session, IoBufferPtr* msgs, int count, bool& wait);
+
+    /// Check whether the session can go on reading incoming data
+    ///
+    /// When the work manager is overloaded (see WorkManager::SetTaskLimit()), the session will stop reading
+    /// until the load of the work manager goes down. And if SetReadPauseOnWriteBlocked() is on, when the peer is not
+    /// taking the outgoing data (see Session::IsWritable()), the session will stop reading until it is writable again.
+    ///
+    /// @param session Current session
+    /// @return Return true if the session can go on reading
+    virtual bool CanRead(SessionPtr session);
+
+    /// The callback function for the Writable event, it resumes the reading stopped by CanRead()
+    /// (a subclass which overrides it should call it too)
+    ///
+    /// @param session Current session
+    virtual void OnWritable(SessionPtr session);
+
     /// The callback function for the Write event
     ///
     /// @param session Current session
@@ -149,6 +213,8 @@ protected:
     WorkManagerPtr m_manager;
     WorkPtr m_work;
 
+    bool m_pausereadonwriteblocked;
+
     /// The default callback function for the OnWrite event to process outgoing data asynchronously
     ///
     /// @param session Current session
@@ -156,9 +222,22 @@ protected:
     /// @return The flags of the event processing: 1 = async, 2 = concurrent, 3 = both 1 and 2
     int DefaultAsyncProcessOnWrite(SessionPtr session, IoBufferPtr data);
 
-private:
-
+    /// Add the message to the work manager as a task
+    ///
+    /// The orderly messages of the session will be run one by one in its serial queue,
+    /// the others will be run with concurrency (all with the priority from GetPriority() and the timeout from GetTaskTimeout())
+    ///
+    /// @param session Current session
+    /// @param work The work which will process the message
+    /// @param data The message data
+    /// @param optype The operation type (1 for read, 2 for write)
+    /// @return The flags of the event processing: it is always 3 (async and concurrent)
+    int AddMessageTask(SessionPtr session, WorkPtr work, IoBufferPtr data, int optype);
 
+    /// Add the tasks collected in current thread (by OnReadBatch()) to the work manager
+    ///
+    /// @param batch The tasks collected
+    void FlushMessageTasks(MessageTaskBatch* batch);
 
 };
 
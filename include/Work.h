@@ -51,6 +51,13 @@ public:
     /// @return The return code
     virtual int Run(BufferPtr workdata);
 
+    /// The callback function for the task which has waited too long in the work manager (it is called instead of Run())
+    ///
+    /// @param workdata The working data
+    /// @param waited How long the task has waited since it was added (in milliseconds)
+    /// @return The return code
+    virtual int Drop(BufferPtr workdata, int waited);
+
 protected:
 
 private:
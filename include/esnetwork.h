@@ -37,9 +37,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "Business.h"
 #include "Client.h"
 #include "CommonData.h"
+#include "CompressionFilter.h"
 #include "IoBuffer.h"
 #include "IoBufferManager.h"
 #include "IoFilter.h"
+#include "IoFilterChain.h"
 #include "IoHandler.h"
 #include "IoService.h"
 #include "IoServiceManager.h"
@@ -47,6 +49,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "Logger.h"
 #include "LogManager.h"
 #include "MessageCodec.h"
+#include "MessageCodecT.h"
 #include "MessageHandler.h"
 #include "Server.h"
 #include "Session.h"
@@ -0,0 +1,132 @@
+#include <string>
+#include <iostream>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "json.h"
+#include "IoBuffer.h"
+
+#include "JsonMessage.h"
+#include "JsonStream.h"
+
+#include "JsonBench.h"
+
+using namespace esnlib;
+
+static json::Object MakeSmallObject()
+{
+    json::Object obj;
+    obj["action"] = 1;
+    obj["text"] = "Hello, this is a string request from the client.";
+    return obj;
+}
+
+static json::Object MakeLargeObject()
+{
+    json::Object obj;
+    obj["action"] = 2;
+    obj["session"] = 123456;
+    obj["ratio"] = 0.5;
+    obj["ok"] = true;
+
+    json::Array items;
+    for(int i=0; i<50; i++)
+    {
+        json::Object item;
+        item["id"] = i;
+        item["name"] = "item name with some text";
+        item["price"] = i * 100 + 99;
+        item["tags"] = json::Array();
+        items.push_back(item);
+    }
+    obj["items"] = items;
+
+    return obj;
+}
+
+static IoBufferPtr EncodeOld(const json::Object& obj)
+{
+    std::string jsonstr = json::Serialize(obj);
+    IoBufferPtr buf = CreateIoBuffer(jsonstr.length() + JsonMessage::HEADER_SIZE);
+    buf->PutInt(JsonMessage::HEADER_SIGN);
+    buf->PutInt(1);
+    buf->PutInt(JsonMessage::DEFAULT_FLAG);
+    buf->PutInt(jsonstr.length());
+    buf->PutStr(jsonstr);
+    return buf;
+}
+
+static IoBufferPtr EncodeNew(const json::Object& obj)
+{
+    IoBufferPtr buf = CreateIoBuffer(JsonMessage::HEADER_SIZE + JsonMessage::DEFAULT_BODY_SIZE);
+    buf->PutInt(JsonMessage::HEADER_SIGN);
+    buf->PutInt(1);
+    buf->PutInt(JsonMessage::DEFAULT_FLAG);
+    buf->PutInt(0);
+    int jsonstrlen = JsonStream::Write(buf.get(), obj);
+    buf->SetWritePos(JsonMessage::LEN_POS);
+    buf->PutInt(jsonstrlen);
+    return buf;
+}
+
+static bool DecodeOld(IoBufferPtr buf, json::Object& obj)
+{
+    int jsonstrlen = JsonMessage::GetJsonStrLenFromBuffer(buf.get());
+    std::string jsonstr(buf->data() + JsonMessage::HEADER_SIZE, jsonstrlen);
+    json::Value value = json::Deserialize(jsonstr);
+    if(value.GetType() != json::ObjectVal) return false;
+    obj = value;
+    return true;
+}
+
+static bool DecodeNew(IoBufferPtr buf, json::Object& obj)
+{
+    return JsonMessage::GetJsonObjFromBuffer(buf.get(), obj);
+}
+
+static void RunCase(const std::string& name, const json::Object& obj, int rounds)
+{
+    IoBufferPtr oldbuf = EncodeOld(obj);
+    IoBufferPtr newbuf = EncodeNew(obj);
+
+    json::Object oldobj, newobj, crossobj;
+    bool same = DecodeOld(oldbuf, oldobj) && DecodeNew(newbuf, newobj) && DecodeOld(newbuf, crossobj)
+                && oldobj == obj && newobj == obj && crossobj == obj;
+
+    std::cout << "[" << name << "] " << (newbuf->size() - JsonMessage::HEADER_SIZE) << " bytes, "
+              << (same ? "results match" : "RESULTS DO NOT MATCH") << std::endl;
+
+    boost::posix_time::ptime start;
+    long long oldencode, newencode, olddecode, newdecode;
+    int checksum = 0;
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    for(int i=0; i<rounds; i++) checksum += EncodeOld(obj)->size();
+    oldencode = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    for(int i=0; i<rounds; i++) checksum += EncodeNew(obj)->size();
+    newencode = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    for(int i=0; i<rounds; i++) { json::Object o; DecodeOld(oldbuf, o); checksum += o.size(); }
+    olddecode = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    for(int i=0; i<rounds; i++) { json::Object o; DecodeNew(newbuf, o); checksum += o.size(); }
+    newdecode = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+    std::cout << "  encode: old " << (oldencode * 1000.0 / rounds) << " ns, new " << (newencode * 1000.0 / rounds)
+              << " ns (" << (newencode > 0 ? (double)oldencode / newencode : 0) << "x)" << std::endl;
+    std::cout << "  decode: old " << (olddecode * 1000.0 / rounds) << " ns, new " << (newdecode * 1000.0 / rounds)
+              << " ns (" << (newdecode > 0 ? (double)olddecode / newdecode : 0) << "x)" << std::endl;
+    if(checksum == 0) std::cout << std::endl;
+}
+
+void esnlib::RunJsonBench(int rounds)
+{
+    if(rounds <= 0) rounds = 1;
+    std::cout << "JSON benchmark (" << rounds << " rounds)" << std::endl;
+    RunCase("small", MakeSmallObject(), rounds);
+    RunCase("large", MakeLargeObject(), rounds / 10 + 1);
+}
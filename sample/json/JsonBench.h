@@ -0,0 +1,13 @@
+#ifndef _ESN_JSONBENCH_H_
+#define _ESN_JSONBENCH_H_
+
+namespace esnlib
+{
+
+// Compare json::Serialize()/json::Deserialize() (with string copies) with JsonStream (in place)
+// by encoding and decoding the same messages for many rounds
+void RunJsonBench(int rounds);
+
+}
+
+#endif // _ESN_JSONBENCH_H_
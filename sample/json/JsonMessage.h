@@ -22,6 +22,8 @@ public:
 
 	static const int DEFAULT_FLAG = 3;
 
+	static const int DEFAULT_BODY_SIZE = 240;
+
 	explicit JsonMessage(int msgtype);
 	JsonMessage(int msgtype, const json::Object * obj);
 	JsonMessage(int msgtype, const std::string& str);
@@ -38,6 +40,7 @@ public:
 
 	static int GetMessageTypeFromBuffer(IoBuffer* data);
 	static int GetJsonStrLenFromBuffer(IoBuffer* data);
+	static bool GetJsonObjFromBuffer(IoBuffer* data, json::Object& obj);
 
 	static void Send(Session * session, JsonMessage * jsonmsg);
 	static void SendObject(Session * session, int msgtype, const json::Object & jsonobj);
@@ -3,6 +3,7 @@
 
 #include "json.h"
 #include "JsonMessage.h"
+#include "JsonStream.h"
 
 #include "JsonMessageCodec.h"
 
@@ -24,20 +25,25 @@ IoBufferPtr JsonMessageCodec::Encode(SessionPtr session, void* data)
     json::Object * obj = msg->GetJsonObj();
 	if(!obj) return newtask;
 
-	std::string jsonstr = "";
+	// serialize the object straight into the buffer (it will grow if needed), no temporary string
+	newtask = session->GetFreeBuffer(JsonMessage::HEADER_SIZE + JsonMessage::DEFAULT_BODY_SIZE);
+	if(!newtask) return newtask;
 
-	try
-	{
-		jsonstr = json::Serialize(*obj);
-	}
-	catch(...) { std::cout << "Exception found when encode json object to string. " << std::endl; }
-
-	newtask = session->GetFreeBuffer(jsonstr.length() + JsonMessage::HEADER_SIZE);
     newtask->PutInt(JsonMessage::HEADER_SIGN);
 	newtask->PutInt(msg->GetMessageType());
 	newtask->PutInt(JsonMessage::DEFAULT_FLAG);
-    newtask->PutInt(jsonstr.length());
-	newtask->PutStr(jsonstr);
+    newtask->PutInt(0);
+
+	int jsonstrlen = JsonStream::Write(newtask.get(), *obj);
+	if(jsonstrlen < 0)
+	{
+		std::cout << "Failed to encode json object. " << std::endl;
+		newtask.reset();
+		return newtask;
+	}
+
+	newtask->SetWritePos(JsonMessage::LEN_POS);
+    newtask->PutInt(jsonstrlen);
     newtask->SetWritePos(0);
     return newtask;
 }
@@ -4,6 +4,7 @@
 #include "IoHandler.h"
 #include "IoBuffer.h"
 
+#include "JsonMessage.h"
 #include "JsonMessageHandler.h"
 
 #include "JsonMessageProcess.h"
@@ -19,14 +20,14 @@ int JsonMessageProcess::Handle(IoBufferPtr data)
 
     BusinessPtr biz;
 
-    std::string jsonstr = "";
-
 	try
 	{
-        char * str = (char*) session->DecodeBuffer(data);
-        if(str) jsonstr = str;
-
-		json::Object msg = json::Deserialize(jsonstr);
+		json::Object msg;
+		if(!JsonMessage::GetJsonObjFromBuffer(data.get(), msg))
+		{
+			std::cout << "Invalid json message! Session: " << session->GetId() << std::endl;
+			return 0;
+		}
 
 		IoHandlerPtr handler = session->GetIoHandler();
 		if(handler)
@@ -37,7 +38,7 @@ int JsonMessageProcess::Handle(IoBufferPtr data)
 
         if(biz) Process(session, biz, msg);
 	}
-	catch(...) { std::cout << "Exception found when handle json string: " << std::endl << jsonstr << std::endl; }
+	catch(...) { std::cout << "Exception found when handle json message. Session: " << session->GetId() << std::endl; }
 
 	if(!biz) std::cout << "Fail to find business object! Session: " << session->GetId() << std::endl;
 
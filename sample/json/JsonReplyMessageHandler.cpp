@@ -38,12 +38,8 @@ int JsonReplyMessageHandler::OnWrite(SessionPtr session, IoBufferPtr data)
     ClientBusiness* clibiz = JsonClientMessageProcess::GetClientBusinessFromSession(session);
     if(clibiz)
     {
-        std::string jsonstr = "";
-
-        char * str = (char*) session->DecodeBuffer(data);
-        if(str) jsonstr = str;
-
-        json::Object msg = json::Deserialize(jsonstr);
+        json::Object msg;
+        JsonMessage::GetJsonObjFromBuffer(data.get(), msg);
         std::string text = msg["text"];
 
         int reqact = StringRequestProcess::ACT_UPPER;
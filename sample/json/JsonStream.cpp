@@ -0,0 +1,534 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "JsonStream.h"
+
+using namespace esnlib;
+
+namespace
+{
+
+// the members of json::Value are protected, this gives read access to them without copying
+struct JsonValueAccess : public json::Value
+{
+    static const json::Object& GetObject(const json::Value& v) { return v.*(&JsonValueAccess::mObjectVal); }
+    static const json::Array& GetArray(const json::Value& v) { return v.*(&JsonValueAccess::mArrayVal); }
+};
+
+class JsonWriter
+{
+public:
+
+    explicit JsonWriter(IoBuffer* buf)
+    : m_buf(buf), m_start(buf->GetWritePos()), m_pos(buf->GetWritePos()), m_failed(false)
+    {
+    }
+
+    // make sure there is enough room, grow the buffer geometrically
+    inline bool Reserve(int len)
+    {
+        if(m_pos + len <= m_buf->size()) return true;
+        int newsize = m_buf->size() * 2;
+        if(newsize < m_pos + len) newsize = m_pos + len;
+        if(newsize < 256) newsize = 256;
+        if(m_buf->size(newsize) != newsize) m_failed = true;
+        return !m_failed;
+    }
+
+    inline void PutChar(char c)
+    {
+        if(Reserve(1)) m_buf->data()[m_pos++] = c;
+    }
+
+    inline void PutRaw(const char* str, int len)
+    {
+        if(Reserve(len))
+        {
+            memcpy(m_buf->data() + m_pos, str, len);
+            m_pos += len;
+        }
+    }
+
+    void PutString(const std::string& str)
+    {
+        static const char HEX[] = "0123456789abcdef";
+
+        const char* p = str.data();
+        int len = str.length();
+
+        // the worst case is "\u00XX" for every char
+        if(!Reserve(len * 6 + 2)) return;
+
+        char* dst = m_buf->data() + m_pos;
+        *dst++ = '"';
+
+        int begin = 0;
+        for(int i=0; i<len; i++)
+        {
+            unsigned char c = p[i];
+            if(c >= 0x20 && c != '"' && c != '\\') continue;
+
+            if(i > begin) { memcpy(dst, p + begin, i - begin); dst += i - begin; }
+            begin = i + 1;
+
+            *dst++ = '\\';
+            switch(c)
+            {
+                case '"' : *dst++ = '"'; break;
+                case '\\': *dst++ = '\\'; break;
+                case '\n': *dst++ = 'n'; break;
+                case '\r': *dst++ = 'r'; break;
+                case '\t': *dst++ = 't'; break;
+                case '\b': *dst++ = 'b'; break;
+                case '\f': *dst++ = 'f'; break;
+                default:
+                    *dst++ = 'u'; *dst++ = '0'; *dst++ = '0';
+                    *dst++ = HEX[c >> 4]; *dst++ = HEX[c & 0x0f];
+                    break;
+            }
+        }
+        if(len > begin) { memcpy(dst, p + begin, len - begin); dst += len - begin; }
+
+        *dst++ = '"';
+        m_pos = dst - m_buf->data();
+    }
+
+    void PutInt(int value)
+    {
+        char tmp[16];
+        char* end = tmp + sizeof(tmp);
+        char* p = end;
+        unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+        do { *--p = '0' + (v % 10); v /= 10; } while(v);
+        if(value < 0) *--p = '-';
+        PutRaw(p, end - p);
+    }
+
+    void PutDouble(double value, int precision)
+    {
+        char tmp[32];
+        int len = snprintf(tmp, sizeof(tmp), "%.*g", precision, value);
+        if(len <= 0 || len >= (int)sizeof(tmp)) { m_failed = true; return; }
+        // JSON has no NaN or Infinity
+        if(tmp[0] == 'n' || tmp[0] == 'i' || tmp[1] == 'i' || tmp[1] == 'n') PutRaw("null", 4);
+        else PutRaw(tmp, len);
+    }
+
+    void PutObject(const json::Object& obj, int depth)
+    {
+        if(depth > JsonStream::MAX_DEPTH) { m_failed = true; return; }
+        PutChar('{');
+        bool first = true;
+        for(json::Object::ValueMap::const_iterator it = obj.begin(); it != obj.end() && !m_failed; ++it)
+        {
+            if(!first) PutChar(',');
+            first = false;
+            PutString(it->first);
+            PutChar(':');
+            PutValue(it->second, depth);
+        }
+        PutChar('}');
+    }
+
+    void PutArray(const json::Array& arr, int depth)
+    {
+        if(depth > JsonStream::MAX_DEPTH) { m_failed = true; return; }
+        PutChar('[');
+        for(size_t i=0; i<arr.size() && !m_failed; i++)
+        {
+            if(i > 0) PutChar(',');
+            PutValue(arr[i], depth);
+        }
+        PutChar(']');
+    }
+
+    void PutValue(const json::Value& v, int depth)
+    {
+        switch(v.GetType())
+        {
+            case json::IntVal       : PutInt(v.ToInt(0)); break;
+            case json::FloatVal     : PutDouble(v.ToFloat(0), 9); break;
+            case json::DoubleVal    : PutDouble(v.ToDouble(0), 17); break;
+            case json::BoolVal      : if(v.ToBool(false)) PutRaw("true", 4); else PutRaw("false", 5); break;
+            case json::StringVal    : PutString(v.ToString(std::string())); break;
+            case json::ObjectVal    : PutObject(JsonValueAccess::GetObject(v), depth + 1); break;
+            case json::ArrayVal     : PutArray(JsonValueAccess::GetArray(v), depth + 1); break;
+            default                 : PutRaw("null", 4); break;
+        }
+    }
+
+    int Finish()
+    {
+        if(m_failed) return -1;
+        m_buf->size(m_pos);
+        m_buf->SetWritePos(m_pos);
+        return m_pos - m_start;
+    }
+
+private:
+
+    IoBuffer* m_buf;
+    int m_start;
+    int m_pos;
+    bool m_failed;
+};
+
+class JsonReader
+{
+public:
+
+    JsonReader(const char* str, int len)
+    : m_pos(str), m_end(str + len)
+    {
+    }
+
+    inline void SkipSpaces()
+    {
+        while(m_pos < m_end && (*m_pos == ' ' || *m_pos == '\n' || *m_pos == '\r' || *m_pos == '\t')) m_pos++;
+    }
+
+    inline bool Expect(char c)
+    {
+        SkipSpaces();
+        if(m_pos < m_end && *m_pos == c) { m_pos++; return true; }
+        return false;
+    }
+
+    // find the end of the plain part of a string (the closing quote, an escape or a control char)
+    inline const char* ScanString(const char* p)
+    {
+#ifdef __SSE2__
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i slash = _mm_set1_epi8('\\');
+        const __m128i ctrl = _mm_set1_epi8(0x1f);
+        while(m_end - p >= 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, slash)),
+                                        _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl));
+            int mask = _mm_movemask_epi8(hits);
+            if(mask) return p + __builtin_ctz(mask);
+            p += 16;
+        }
+#endif
+        while(p < m_end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) p++;
+        return p;
+    }
+
+    static void PutUtf8(std::string& str, unsigned int code)
+    {
+        if(code < 0x80) str.push_back((char)code);
+        else if(code < 0x800)
+        {
+            str.push_back((char)(0xc0 | (code >> 6)));
+            str.push_back((char)(0x80 | (code & 0x3f)));
+        }
+        else if(code < 0x10000)
+        {
+            str.push_back((char)(0xe0 | (code >> 12)));
+            str.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+            str.push_back((char)(0x80 | (code & 0x3f)));
+        }
+        else
+        {
+            str.push_back((char)(0xf0 | (code >> 18)));
+            str.push_back((char)(0x80 | ((code >> 12) & 0x3f)));
+            str.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+            str.push_back((char)(0x80 | (code & 0x3f)));
+        }
+    }
+
+    bool ReadHex4(unsigned int& code)
+    {
+        if(m_end - m_pos < 4) return false;
+        code = 0;
+        for(int i=0; i<4; i++)
+        {
+            char c = *m_pos++;
+            code <<= 4;
+            if(c >= '0' && c <= '9') code |= c - '0';
+            else if(c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if(c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    // the opening quote has been consumed
+    bool ReadString(std::string& str)
+    {
+        const char* p = ScanString(m_pos);
+        if(p < m_end && *p == '"')
+        {
+            str.assign(m_pos, p - m_pos); // no escape, the most common case
+            m_pos = p + 1;
+            return true;
+        }
+
+        str.clear();
+        while(true)
+        {
+            str.append(m_pos, p - m_pos);
+            m_pos = p;
+            if(m_pos >= m_end) return false;
+
+            char c = *m_pos++;
+            if(c == '"') return true;
+            if(c != '\\') return false; // control char
+
+            if(m_pos >= m_end) return false;
+            c = *m_pos++;
+            switch(c)
+            {
+                case '"' : str.push_back('"'); break;
+                case '\\': str.push_back('\\'); break;
+                case '/' : str.push_back('/'); break;
+                case 'n' : str.push_back('\n'); break;
+                case 'r' : str.push_back('\r'); break;
+                case 't' : str.push_back('\t'); break;
+                case 'b' : str.push_back('\b'); break;
+                case 'f' : str.push_back('\f'); break;
+                case 'u' :
+                {
+                    unsigned int code = 0;
+                    if(!ReadHex4(code)) return false;
+                    if(code >= 0xd800 && code < 0xdc00 && m_end - m_pos >= 6 && m_pos[0] == '\\' && m_pos[1] == 'u')
+                    {
+                        unsigned int low = 0;
+                        m_pos += 2;
+                        if(!ReadHex4(low) || low < 0xdc00 || low >= 0xe000) return false;
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    PutUtf8(str, code);
+                    break;
+                }
+                default: return false;
+            }
+
+            p = ScanString(m_pos);
+        }
+    }
+
+    bool ReadNumber(json::Value& value)
+    {
+        const char* begin = m_pos;
+        const char* p = m_pos;
+        bool negative = false;
+        if(p < m_end && *p == '-') { negative = true; p++; }
+        if(p >= m_end || *p < '0' || *p > '9') return false;
+
+        long long intval = 0;
+        bool overflow = false;
+        while(p < m_end && *p >= '0' && *p <= '9')
+        {
+            intval = intval * 10 + (*p - '0');
+            if(intval > (long long)INT_MAX + 1) overflow = true;
+            p++;
+        }
+
+        bool isfloat = false;
+        if(p < m_end && *p == '.')
+        {
+            isfloat = true;
+            p++;
+            if(p >= m_end || *p < '0' || *p > '9') return false;
+            while(p < m_end && *p >= '0' && *p <= '9') p++;
+        }
+        if(p < m_end && (*p == 'e' || *p == 'E'))
+        {
+            isfloat = true;
+            p++;
+            if(p < m_end && (*p == '+' || *p == '-')) p++;
+            if(p >= m_end || *p < '0' || *p > '9') return false;
+            while(p < m_end && *p >= '0' && *p <= '9') p++;
+        }
+
+        m_pos = p;
+
+        if(!isfloat && !overflow)
+        {
+            if(negative) intval = -intval;
+            if(intval >= INT_MIN && intval <= INT_MAX)
+            {
+                value = json::Value((int)intval);
+                return true;
+            }
+        }
+
+        // strtod() needs '\0' at the end
+        char tmp[64];
+        int len = p - begin;
+        if(len >= (int)sizeof(tmp)) return false;
+        memcpy(tmp, begin, len);
+        tmp[len] = '\0';
+        value = json::Value(strtod(tmp, NULL));
+        return true;
+    }
+
+    inline bool ReadWord(const char* word, int len)
+    {
+        if(m_end - m_pos < len || memcmp(m_pos, word, len) != 0) return false;
+        m_pos += len;
+        return true;
+    }
+
+    // count the items of the array (the opening bracket has been consumed), so they can be parsed in place
+    int CountItems()
+    {
+        const char* p = m_pos;
+        int level = 0;
+        int count = 0;
+        bool empty = true;
+        while(p < m_end)
+        {
+            char c = *p++;
+            if(c == '"')
+            {
+                empty = false;
+                while(true)
+                {
+                    p = ScanString(p);
+                    if(p >= m_end) return -1;
+                    if(*p == '"') { p++; break; }
+                    if(*p == '\\') p += 2;
+                    else return -1;
+                }
+            }
+            else if(c == '[' || c == '{') { level++; empty = false; }
+            else if(c == ']' || c == '}')
+            {
+                if(level == 0) return empty ? 0 : count + 1;
+                level--;
+            }
+            else if(c == ',' && level == 0) count++;
+            else if(c != ' ' && c != '\n' && c != '\r' && c != '\t') empty = false;
+        }
+        return -1;
+    }
+
+    bool ReadObject(json::Value& value, int depth)
+    {
+        value = json::Object();
+
+        SkipSpaces();
+        if(m_pos < m_end && *m_pos == '}') { m_pos++; return true; }
+
+        std::string key;
+        while(true)
+        {
+            if(!Expect('"')) return false;
+            if(!ReadString(key)) return false;
+            if(!Expect(':')) return false;
+            if(!ReadValue(value[key], depth)) return false;
+
+            SkipSpaces();
+            if(m_pos >= m_end) return false;
+            char c = *m_pos++;
+            if(c == '}') return true;
+            if(c != ',') return false;
+            SkipSpaces();
+        }
+    }
+
+    bool ReadArray(json::Value& value, int depth)
+    {
+        int count = CountItems();
+        if(count < 0) return false;
+
+        json::Array items;
+        for(int i=0; i<count; i++) items.push_back(json::Value());
+        value = items;
+
+        for(int i=0; i<count; i++)
+        {
+            if(i > 0 && !Expect(',')) return false;
+            if(!ReadValue(value[(size_t)i], depth)) return false;
+        }
+
+        return Expect(']');
+    }
+
+    bool ReadValue(json::Value& value, int depth)
+    {
+        if(depth > JsonStream::MAX_DEPTH) return false;
+
+        SkipSpaces();
+        if(m_pos >= m_end) return false;
+
+        char c = *m_pos;
+        switch(c)
+        {
+            case '{': m_pos++; return ReadObject(value, depth + 1);
+            case '[': m_pos++; return ReadArray(value, depth + 1);
+            case '"':
+            {
+                m_pos++;
+                std::string str;
+                if(!ReadString(str)) return false;
+                value = json::Value(str);
+                return true;
+            }
+            case 't': if(!ReadWord("true", 4)) return false; value = json::Value(true); return true;
+            case 'f': if(!ReadWord("false", 5)) return false; value = json::Value(false); return true;
+            case 'n': if(!ReadWord("null", 4)) return false; value = json::Value(); return true;
+            default: return ReadNumber(value);
+        }
+    }
+
+    bool Read(json::Object& obj)
+    {
+        obj.Clear();
+        if(!Expect('{')) return false;
+
+        SkipSpaces();
+        if(m_pos < m_end && *m_pos == '}') { m_pos++; SkipSpaces(); return m_pos == m_end; }
+
+        std::string key;
+        while(true)
+        {
+            if(!Expect('"')) return false;
+            if(!ReadString(key)) return false;
+            if(!Expect(':')) return false;
+            if(!ReadValue(obj[key], 1)) return false;
+
+            SkipSpaces();
+            if(m_pos >= m_end) return false;
+            char c = *m_pos++;
+            if(c == '}') break;
+            if(c != ',') return false;
+        }
+
+        SkipSpaces();
+        return m_pos == m_end;
+    }
+
+private:
+
+    const char* m_pos;
+    const char* m_end;
+};
+
+}
+
+int JsonStream::Write(IoBuffer* buf, const json::Object& obj)
+{
+    if(!buf) return -1;
+    JsonWriter writer(buf);
+    writer.PutObject(obj, 1);
+    return writer.Finish();
+}
+
+bool JsonStream::Read(const char* str, int len, json::Object& obj)
+{
+    if(!str || len <= 0) return false;
+    JsonReader reader(str, len);
+    bool done = reader.Read(obj);
+    if(!done) obj.Clear();
+    return done;
+}
@@ -1,5 +1,7 @@
 #define JSON_SSL
 
+//#define JSON_BENCH
+
 #define JSON_SERVER
 //#define JSON_CLIENT
 //#define JSON_CLIENTS
@@ -46,6 +48,10 @@
 
 #include "PrintStringProcess.h"
 
+#ifdef JSON_BENCH
+#include "JsonBench.h"
+#endif
+
 
 using namespace std;
 using namespace esnlib;
@@ -277,6 +283,12 @@ void HandleInput(ClientPtr client)
 
 int main()
 {
+#ifdef JSON_BENCH
+    // compare the json codec with the old way (json::Serialize/json::Deserialize) and quit
+    RunJsonBench(100000);
+    return 0;
+#endif
+
     // print help
     PrintHelp();
 
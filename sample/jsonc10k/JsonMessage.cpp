@@ -1,3 +1,5 @@
+#include "JsonStream.h"
+
 #include "JsonMessage.h"
 
 using namespace esnlib;
@@ -72,6 +74,17 @@ int JsonMessage::GetJsonStrLenFromBuffer(IoBuffer* data)
     return data->GetInt();
 }
 
+bool JsonMessage::GetJsonObjFromBuffer(IoBuffer* data, json::Object& obj)
+{
+	if(!data || data->size() < JsonMessage::HEADER_SIZE) return false;
+
+	int jsonstrlen = JsonMessage::GetJsonStrLenFromBuffer(data);
+	if(jsonstrlen <= 0 || jsonstrlen > data->size() - JsonMessage::HEADER_SIZE) return false;
+
+	// parse the json string in place (no copy)
+	return JsonStream::Read(data->data() + JsonMessage::HEADER_SIZE, jsonstrlen, obj);
+}
+
 void JsonMessage::Send(Session * session, JsonMessage * jsonmsg)
 {
 	if(session && jsonmsg) session->Write((void*)jsonmsg);
@@ -0,0 +1,32 @@
+#ifndef _ESN_JSONSTREAM_H_
+#define _ESN_JSONSTREAM_H_
+
+#include "json.h"
+#include "IoBuffer.h"
+
+namespace esnlib
+{
+
+// Fast JSON writer/reader for the json samples, it works with the DOM of SuperEasyJSON (json::Object)
+// but without the temporary strings of json::Serialize() and json::Deserialize()
+class JsonStream
+{
+public:
+
+    static const int MAX_DEPTH = 256;
+
+    // Serialize the object straight into the buffer (at its write position, the buffer will grow if needed)
+    // Return the number of bytes written, or -1 if failed
+    static int Write(IoBuffer* buf, const json::Object& obj);
+
+    // Parse the JSON text in place (the text does not need to end with '\0')
+    // Return false if the text is not a valid JSON object
+    static bool Read(const char* str, int len, json::Object& obj);
+
+protected:
+private:
+};
+
+}
+
+#endif // _ESN_JSONSTREAM_H_
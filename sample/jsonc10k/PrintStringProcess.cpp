@@ -8,6 +8,7 @@
 
 #include "Session.h"
 #include "json.h"
+#include "JsonMessage.h"
 
 #include "PrintStringProcess.h"
 
@@ -22,12 +23,8 @@ int PrintStringProcess::Handle(IoBufferPtr data)
 	SessionPtr session = data->session();
     if(!session) return 0;
 
-    std::string jsonstr = "";
-
-    char * str = (char*) session->DecodeBuffer(data);
-    if(str) jsonstr = str;
-
-    json::Object msg = json::Deserialize(jsonstr);
+    json::Object msg;
+    if(!JsonMessage::GetJsonObjFromBuffer(data.get(), msg)) return 0;
     std::string text = msg["text"];
 
     boost::this_thread::sleep(boost::posix_time::milliseconds(5000));
@@ -57,3 +57,8 @@ void Buffer::recyclable(bool value)
     m_recyclable = value;
 }
 
+int Buffer::datasize() const
+{
+    return 0;
+}
+
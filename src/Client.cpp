@@ -286,7 +286,7 @@ IoBufferPtr ClientImpl::GetFreeBuffer(int bufsize)
     }
     else
     {
-        IoBufferPtr newtask(new IoBuffer(bufsize));
+        IoBufferPtr newtask = CreateIoBuffer(bufsize);
         task = newtask;
     }
     return task;
@@ -451,6 +451,7 @@ bool ClientImpl::ConnectWithIpAddr(const std::string& svraddr, int svrport)
     session->SetIoHandler(m_handler);
     session->SetIoFilter(m_filter);
     session->SetBufferManager(m_bufmgr);
+    if(svc) session->SetIoService(svc);
 
     m_connecting = true;
 
@@ -603,6 +604,7 @@ bool ClientImpl::ConnectWithDomainName(const std::string& svraddr, int svrport)
     session->SetIoHandler(m_handler);
     session->SetIoFilter(m_filter);
     session->SetBufferManager(m_bufmgr);
+    if(svc) session->SetIoService(svc);
 
     m_connecting = true;
 
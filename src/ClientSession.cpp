@@ -57,6 +57,22 @@ void ClientSession::Init()
     m_maxreadqueuesize = 1024;
     m_maxwritequeuesize = 0;
 
+    m_maxgathercount = ESN_MAX_GATHER_WRITE_COUNT;
+    m_maxgatherbytes = ESN_MAX_GATHER_WRITE_BYTES;
+
+    m_readstart = 0;
+    m_readend = 0;
+
+    m_writing = false;
+    m_writingcount = 0;
+
+    m_writequeuebytes = 0;
+    m_highwatermark = ESN_WRITE_HIGH_WATERMARK;
+    m_lowwatermark = ESN_WRITE_LOW_WATERMARK;
+    m_writeblocked = false;
+    m_notifiedblocked = false;
+    m_notifyingwrite = false;
+
     m_remoteip = "";
     m_remoteport = 0;
 
@@ -66,6 +82,10 @@ void ClientSession::Init()
     m_asyncreadevents = 0;
     m_asyncwriteevents = 0;
 
+    m_readpaused = false;
+
+    m_servicecounted = false;
+
     //std::cout << "\nInitialized ClientSession: " << (int)this << std::endl;
 }
 
@@ -142,9 +162,11 @@ ClientSession::~ClientSession()
     m_asyncreadevents = 0;
     m_asyncwriteevents = 0;
 
-    if(m_readbuffer && m_readbuffer->recyclable())
+    ReleaseIoService();
+
+    if(m_readblock && m_readblock.use_count() == 1 && m_readblock->recyclable())
     {
-        TakeBack(m_readbuffer);
+        TakeBack(m_readblock);
     }
 
     if(m_readcache && m_readcache->recyclable())
@@ -152,11 +174,6 @@ ClientSession::~ClientSession()
         TakeBack(m_readcache);
     }
 
-    if(m_roundcache && m_roundcache->recyclable())
-    {
-        TakeBack(m_roundcache);
-    }
-
     std::map<int, IoBufferPtr>::iterator itr = m_dataintbufmap.begin();
     while(itr != m_dataintbufmap.end())
     {
@@ -212,21 +229,11 @@ void ClientSession::AfterConnect()
         m_lastreadtime = boost::posix_time::second_clock::local_time();
         m_lastwritetime = boost::posix_time::second_clock::local_time();
 
-        if(!m_readbuffer)
+        if(!m_readblock)
         {
-            m_readbuffer = GetFreeBuffer(m_readbufsize);
-        }
-
-        if(!m_readcache)
-        {
-            m_readcache = GetFreeBuffer(m_readbufsize);
-            if(m_readcache) m_readcache->size(0);
-        }
-
-        if(!m_roundcache)
-        {
-            m_roundcache = GetFreeBuffer(m_readbufsize);
-            if(m_roundcache) m_roundcache->size(0);
+            m_readblock = GetFreeBuffer(m_readbufsize * ESN_READ_BLOCK_FACTOR);
+            m_readstart = 0;
+            m_readend = 0;
         }
 
         boost::asio::socket_base::receive_buffer_size option1(m_readbufsize);
@@ -255,7 +262,7 @@ void ClientSession::AfterConnect()
         //GetSocket().set_option(boost::asio::ip::tcp::no_delay(true), ec3);
         //if(ec3) std::cout << "Error when set no_delay(true): " << ec3.message() << std::endl;
 
-        if(m_readbuffer && m_readcache && m_roundcache)
+        if(m_readblock)
         {
             #ifdef ESN_WITH_SSL
             if(m_gotssl) m_strand->post(boost::bind(&ClientSession::Read, shared_from_this()));
@@ -304,6 +311,16 @@ void ClientSession::Open()
 
     m_mgr.AddSession(shared_from_this());
 
+    if(m_service)
+    {
+        boost::unique_lock<boost::mutex> lock(m_closingmutex);
+        if(!m_servicecounted)
+        {
+            m_service->AddSessionCount(1);
+            m_servicecounted = true;
+        }
+    }
+
     m_state = 1;
 
     m_asyncreadevents = 0;
@@ -392,11 +409,23 @@ void ClientSession::Close(bool rightnow)
         m_localip = "";
         m_localport = 0;
 
+        ReleaseIoService();
+
         m_mgr.RemoveSession(shared_from_this());
     }
 
 }
 
+void ClientSession::ReleaseIoService()
+{
+    boost::unique_lock<boost::mutex> lock(m_closingmutex);
+    if(m_service && m_servicecounted)
+    {
+        m_service->AddSessionCount(-1);
+        m_servicecounted = false;
+    }
+}
+
 bool ClientSession::Connected()
 {
     return m_state > 0 && !m_closing && GetSocket().is_open();
@@ -454,6 +483,120 @@ void ClientSession::SetMaxMessageQueueSize(int optype, int value)
     else if(optype == 2) m_maxwritequeuesize = value;
 }
 
+int ClientSession::GetGatherWriteLimit(int limittype)
+{
+    if(limittype == 1) return m_maxgathercount;
+    else if(limittype == 2) return m_maxgatherbytes;
+
+    return 0;
+}
+
+void ClientSession::SetGatherWriteLimit(int limittype, int value)
+{
+    if(value < 1) value = 1;
+
+    if(limittype == 1) m_maxgathercount = value;
+    else if(limittype == 2) m_maxgatherbytes = value;
+}
+
+int ClientSession::GetWriteWatermark(int marktype)
+{
+    if(marktype == 1) return m_highwatermark;
+    else if(marktype == 2) return m_lowwatermark;
+
+    return 0;
+}
+
+void ClientSession::SetWriteWatermark(int marktype, int value)
+{
+    if(value < 0) value = 0;
+
+    int change = 0;
+
+    {
+        boost::unique_lock<boost::mutex> lock(m_writemutex);
+
+        if(marktype == 1) m_highwatermark = value;
+        else if(marktype == 2) m_lowwatermark = value;
+
+        change = UpdateWriteQueueBytes(0); // check it again with the new watermarks
+    }
+
+    NotifyWriteState(change);
+}
+
+int ClientSession::GetWriteQueueBytes()
+{
+    boost::unique_lock<boost::mutex> lock(m_writemutex);
+    return m_writequeuebytes;
+}
+
+bool ClientSession::IsWritable()
+{
+    boost::unique_lock<boost::mutex> lock(m_writemutex);
+    return !m_writeblocked;
+}
+
+int ClientSession::UpdateWriteQueueBytes(int bytes)
+{
+    m_writequeuebytes += bytes;
+    if(m_writequeuebytes < 0) m_writequeuebytes = 0;
+
+    if(!m_writeblocked)
+    {
+        if(m_highwatermark > 0 && m_writequeuebytes >= m_highwatermark)
+        {
+            m_writeblocked = true;
+            return 1;
+        }
+    }
+    else
+    {
+        if(m_highwatermark <= 0 || m_writequeuebytes <= m_lowwatermark)
+        {
+            m_writeblocked = false;
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+void ClientSession::NotifyWriteState(int change)
+{
+    if(change == 0 || !m_handler) return;
+
+    boost::unique_lock<boost::mutex> lock(m_writemutex);
+
+    // only one thread fires the events at a time, and it keeps firing until the last state has been reported,
+    // so the events will always be in the same order as the changes (even if they come from different threads)
+    if(m_notifyingwrite) return;
+    m_notifyingwrite = true;
+
+    while(m_notifiedblocked != m_writeblocked)
+    {
+        bool blocked = m_writeblocked;
+        m_notifiedblocked = blocked;
+
+        lock.unlock();
+
+        if(blocked)
+        {
+            try { m_handler->OnWriteBlocked(shared_from_this()); }
+            catch(...) { LogManager::Warning( "Exception found in OnWriteBlocked() event." ); }
+        }
+        else
+        {
+            try { m_handler->OnWritable(shared_from_this()); }
+            catch(...) { LogManager::Warning( "Exception found in OnWritable() event." ); }
+        }
+
+        lock.lock();
+    }
+
+    m_notifyingwrite = false;
+}
+
 boost::shared_ptr<IoFilter> ClientSession::GetIoFilter()
 {
     return m_filter;
@@ -466,6 +609,12 @@ boost::shared_ptr<IoHandler> ClientSession::GetIoHandler()
 
 boost::shared_ptr<IoBuffer> ClientSession::GetReadCache()
 {
+    // most sessions never need it, so it is got from the pool only when it is asked for
+    if(!m_readcache)
+    {
+        m_readcache = GetFreeBuffer(m_readbufsize);
+        if(m_readcache) m_readcache->size(0);
+    }
     return m_readcache;
 }
 
@@ -483,7 +632,7 @@ boost::shared_ptr<IoBuffer> ClientSession::GetFreeBuffer(int bufsize)
     }
     else
     {
-        IoBufferPtr newtask(new IoBuffer(bufsize));
+        IoBufferPtr newtask = CreateIoBuffer(bufsize);
         if(newtask && newtask->size() >= bufsize)
         {
             newtask->session(shared_from_this());
@@ -509,7 +658,7 @@ void ClientSession::TakeBack(boost::shared_ptr<Buffer> buf)
 boost::shared_ptr<IoBuffer> ClientSession::EncodeBuffer(void* data)
 {
     IoBufferPtr buf;
-    if(m_filter) buf = m_filter->Encode(shared_from_this(), data);
+    if(m_filter) buf = m_filter->EncodeAndFinish(shared_from_this(), data);
     return buf;
 }
 void* ClientSession::DecodeBuffer(boost::shared_ptr<IoBuffer> data)
@@ -539,6 +688,22 @@ CommonDataPtr ClientSession::GetData()
     return data;
 }
 
+BusinessPtr ClientSession::GetFilterState(int slot)
+{
+    BusinessPtr state;
+    boost::unique_lock<boost::mutex> lock(m_datamutex);
+    if(slot >= 0 && slot < (int)m_filterstates.size()) state = m_filterstates[slot];
+    return state;
+}
+
+void ClientSession::SetFilterState(int slot, BusinessPtr state)
+{
+    if(slot < 0) return;
+    boost::unique_lock<boost::mutex> lock(m_datamutex);
+    if(slot >= (int)m_filterstates.size()) m_filterstates.resize(slot + 1);
+    m_filterstates[slot] = state;
+}
+
 bool ClientSession::HasGlobalData()
 {
     return m_mgr.HasData();
@@ -609,6 +774,11 @@ void ClientSession::SetBufferManager(IoBufferManagerPtr manager)
     if(!m_bufmgr) m_bufmgr = manager;
 }
 
+void ClientSession::SetIoService(IoServicePtr service)
+{
+    if(!m_service) m_service = service;
+}
+
 bool ClientSession::TestIdle(int idletype, int idletime)
 {
     if(m_state <= 0 || m_closing) return false;
@@ -651,44 +821,80 @@ bool ClientSession::TestIdle(int idletype, int idletime)
 
 void ClientSession::InternalWrite()
 {
-    IoBufferPtr task = m_writelist.front();
-    if(task)
+    // it must be called with lock(m_writemutex)
+
+    if(m_writingcount > 0) return; // a write is in flight already
+
+    if(m_writelist.empty())
     {
-        #ifdef ESN_WITH_SSL
-        if(m_gotssl)
-        {
-            boost::asio::async_write(*m_sslsocket,
-            boost::asio::buffer(task->data(), task->size()),
-            m_strand->wrap(
-            boost::bind(&ClientSession::OnWrite, shared_from_this(),
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred)));
-        }
-        else
+        m_writing = false;
+        return;
+    }
+
+    // gather the queued buffers (as many as the limits allow) and send them out in one write
+    std::vector<boost::asio::const_buffer> buffers;
+
+    int total = 0;
+    IoBufferQueue::iterator itr = m_writelist.begin();
+    while(itr != m_writelist.end())
+    {
+        IoBufferPtr task = *itr;
+        int tasksize = task ? task->size() : 0;
+
+        if(buffers.size() > 0)
         {
-            boost::asio::async_write(*m_socket,
-            boost::asio::buffer(task->data(), task->size()),
-            boost::bind(&ClientSession::OnWrite, shared_from_this(),
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred));
+            if((int)buffers.size() >= m_maxgathercount) break;
+            if(total + tasksize > m_maxgatherbytes) break;
         }
-        #else
-        boost::asio::async_write(*m_socket,
-            boost::asio::buffer(task->data(), task->size()),
-            boost::bind(&ClientSession::OnWrite, shared_from_this(),
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred));
-        #endif
+
+        buffers.push_back(boost::asio::const_buffer(task ? task->data() : NULL, tasksize));
+        total += tasksize;
+
+        itr++;
     }
+
+    m_writing = true;
+    m_writingcount = buffers.size();
+
+    #ifdef ESN_WITH_SSL
+    if(m_gotssl)
+    {
+        boost::asio::async_write(*m_sslsocket, buffers,
+        m_strand->wrap(
+        boost::bind(&ClientSession::OnWrite, shared_from_this(),
+          boost::asio::placeholders::error,
+          boost::asio::placeholders::bytes_transferred)));
+    }
+    else
+    {
+        boost::asio::async_write(*m_socket, buffers,
+        boost::bind(&ClientSession::OnWrite, shared_from_this(),
+          boost::asio::placeholders::error,
+          boost::asio::placeholders::bytes_transferred));
+    }
+    #else
+    boost::asio::async_write(*m_socket, buffers,
+        boost::bind(&ClientSession::OnWrite, shared_from_this(),
+          boost::asio::placeholders::error,
+          boost::asio::placeholders::bytes_transferred));
+    #endif
+}
+
+void ClientSession::InternalSafeWrite()
+{
+    boost::unique_lock<boost::mutex> listlock(m_writemutex);
+    InternalWrite();
 }
 
 void ClientSession::InternalProcessOutgoing(bool& isnothing)
 {
     boost::unique_lock<boost::mutex> listlock(m_writemutex);
 
-    // before send out a new message (via async_write()), we must remove an old message first (if there are some old messages).
-    // and these two actions (removing old and sending new) must be executed in a same thread (with lock(m_writemutex)).
-    if (!m_writelist.empty()) m_writelist.pop_front();
+    // the buffers written have been removed in OnWrite() already,
+    // here we just go on sending the rest (if the last write is done).
+    if(m_writingcount > 0) return;
+
+    m_writing = false;
 
     if (m_writelist.empty()) // if no messages waiting for sending
     {
@@ -701,10 +907,12 @@ void ClientSession::InternalProcessOutgoing(bool& isnothing)
     else
     {
         // continue to send out new messages (if there are some new messages).
+        m_writing = true;
+
         #ifdef ESN_WITH_SSL
         if(m_gotssl)
         {
-            m_strand->post(boost::bind(&ClientSession::InternalWrite, shared_from_this()));
+            m_strand->post(boost::bind(&ClientSession::InternalSafeWrite, shared_from_this()));
         }
         else
         {
@@ -766,7 +974,7 @@ void ClientSession::Write(boost::shared_ptr<IoBuffer> data)
 
     boost::unique_lock<boost::mutex> lock(m_writemutex);
 
-    bool writing = !m_writelist.empty();
+    bool writing = m_writing;
 
     IoBufferPtr newtask = data;
 
@@ -774,14 +982,18 @@ void ClientSession::Write(boost::shared_ptr<IoBuffer> data)
 
     m_writelist.push_back(newtask);
 
+    int change = UpdateWriteQueueBytes(newtask->size());
+
     //printf("Want to write: %d(%d) \n", newtask->size(), data.size());
 
     if (!writing)
     {
+        m_writing = true;
+
         #ifdef ESN_WITH_SSL
         if(m_gotssl)
         {
-            m_strand->post(boost::bind(&ClientSession::InternalWrite, shared_from_this()));
+            m_strand->post(boost::bind(&ClientSession::InternalSafeWrite, shared_from_this()));
         }
         else
         {
@@ -792,6 +1004,10 @@ void ClientSession::Write(boost::shared_ptr<IoBuffer> data)
         #endif
 
     }
+
+    lock.unlock();
+
+    NotifyWriteState(change);
 }
 
 void ClientSession::WriteBuffer(boost::shared_ptr<IoBuffer> data)
@@ -805,6 +1021,46 @@ void ClientSession::Write(const char* buf, int bufsize)
 
     if(buf == NULL || bufsize <= 0) return;
 
+    // copy the data into segments (no large contiguous memory needed), and then send them out as a chain
+    std::vector<IoBufferPtr> chain;
+
+    const char* inputbuf = buf;
+    int leftsize = bufsize;
+
+    while(leftsize > 0)
+    {
+        int segmentsize = leftsize > ESN_WRITE_SEGMENT_SIZE ? ESN_WRITE_SEGMENT_SIZE : leftsize;
+
+        IoBufferPtr newtask;
+        if(m_bufmgr) newtask = m_bufmgr->GetFreeBuffer(segmentsize);
+        else newtask = CreateIoBuffer(segmentsize);
+
+        if(!newtask || newtask->size() < segmentsize)
+        {
+            LogManager::Warning("Failed to get buffer for outgoing data.");
+            return;
+        }
+
+        newtask->SetWritePos(0);
+        newtask->PutBuf((char*)inputbuf, segmentsize);
+        newtask->SetWritePos(0);
+
+        chain.push_back(newtask);
+
+        inputbuf += segmentsize;
+        leftsize -= segmentsize;
+    }
+
+    Write(chain);
+
+}
+
+void ClientSession::Write(const std::vector< boost::shared_ptr<IoBuffer> >& chain)
+{
+    if(m_state <= 0 || m_closing) return;
+
+    if(chain.empty()) return;
+
     int queuesize = 0;
     if (m_maxwritequeuesize > 0)
     {
@@ -821,64 +1077,36 @@ void ClientSession::Write(const char* buf, int bufsize)
         return;
     }
 
-    boost::unique_lock<boost::mutex> lock(m_writemutex);
+    SessionPtr current = shared_from_this();
 
-    bool writing = !m_writelist.empty();
-
-    int datacount = bufsize / ESN_MAX_IOBUF_SIZE;
-    int leftsize = bufsize % ESN_MAX_IOBUF_SIZE;
+    boost::unique_lock<boost::mutex> lock(m_writemutex);
 
-    char* inputbuf = (char*)buf;
+    bool writing = m_writing;
 
-    for(int i = 1; i <= datacount; i++)
+    int bytes = 0;
+    int total = chain.size();
+    for(int i=0; i<total; i++)
     {
-        IoBufferPtr newtask;
-        if(m_bufmgr)
-        {
-            newtask = m_bufmgr->GetFreeBuffer(ESN_MAX_IOBUF_SIZE);
-            newtask->session(shared_from_this());
-            newtask->SetWritePos(0);
-            newtask->PutBuf(inputbuf, ESN_MAX_IOBUF_SIZE);
-            newtask->SetWritePos(0);
-        }
-        else
-        {
-            IoBufferPtr newone(new IoBuffer(inputbuf, ESN_MAX_IOBUF_SIZE));
-            newone->session(shared_from_this());
-            newtask = newone;
-        }
+        IoBufferPtr newtask = chain[i];
+        if(!newtask) continue;
 
-        m_writelist.push_back(newtask);
-        inputbuf += ESN_MAX_IOBUF_SIZE;
-    }
-
-    if(leftsize > 0)
-    {
-        IoBufferPtr newtask;
-        if(m_bufmgr)
-        {
-            newtask = m_bufmgr->GetFreeBuffer(leftsize);
-            newtask->session(shared_from_this());
-            newtask->SetWritePos(0);
-            newtask->PutBuf(inputbuf, leftsize);
-            newtask->SetWritePos(0);
-        }
-        else
-        {
-            IoBufferPtr newone(new IoBuffer(inputbuf, leftsize));
-            newone->session(shared_from_this());
-            newtask = newone;
-        }
+        newtask->session(current);
 
         m_writelist.push_back(newtask);
+
+        bytes += newtask->size();
     }
 
-    if (!writing)
+    int change = UpdateWriteQueueBytes(bytes);
+
+    if (!writing && !m_writelist.empty())
     {
+        m_writing = true;
+
         #ifdef ESN_WITH_SSL
         if(m_gotssl)
         {
-            m_strand->post(boost::bind(&ClientSession::InternalWrite, shared_from_this()));
+            m_strand->post(boost::bind(&ClientSession::InternalSafeWrite, shared_from_this()));
         }
         else
         {
@@ -889,13 +1117,16 @@ void ClientSession::Write(const char* buf, int bufsize)
         #endif
     }
 
+    lock.unlock();
+
+    NotifyWriteState(change);
 }
 
 void ClientSession::Write(void* data)
 {
     if(m_filter)
     {
-        IoBufferPtr newtask = m_filter->Encode(shared_from_this(), data);
+        IoBufferPtr newtask = m_filter->EncodeAndFinish(shared_from_this(), data);
         if(newtask) Write(newtask);
     }
 }
@@ -977,98 +1208,190 @@ void ClientSession::Read()
     if(m_state <= 0) return;
     //if(m_closing) return;
 
-    if (m_readbuffer)
+    if (PrepareReadBlock())
     {
-        m_readbuffer->size(m_readbufsize);
-        m_readbuffer->SetReadPos(0);
-        m_readbuffer->SetWritePos(0);
+        char* buf = m_readblock->data() + m_readend;
+        int bufsize = m_readblock->size() - m_readend;
 
-        if(m_readbuffer->data() && m_readbuffer->size() > 0)
+        #ifdef ESN_WITH_SSL
+        if(m_gotssl)
         {
-            #ifdef ESN_WITH_SSL
-            if(m_gotssl)
-            {
-                m_sslsocket->async_read_some(boost::asio::buffer(m_readbuffer->data(), m_readbuffer->size()),
-                  m_strand->wrap(
-                  boost::bind(&ClientSession::OnRead, shared_from_this(),
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred)));
-            }
-            else
-            {
-                m_socket->async_read_some(boost::asio::buffer(m_readbuffer->data(), m_readbuffer->size()),
-                  boost::bind(&ClientSession::OnRead, shared_from_this(),
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred));
-            }
-            #else
-            m_socket->async_read_some(boost::asio::buffer(m_readbuffer->data(), m_readbuffer->size()),
-                  boost::bind(&ClientSession::OnRead, shared_from_this(),
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred));
-            #endif
-
+            m_sslsocket->async_read_some(boost::asio::buffer(buf, bufsize),
+              m_strand->wrap(
+              boost::bind(&ClientSession::OnRead, shared_from_this(),
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred)));
         }
+        else
+        {
+            m_socket->async_read_some(boost::asio::buffer(buf, bufsize),
+              boost::bind(&ClientSession::OnRead, shared_from_this(),
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+        }
+        #else
+        m_socket->async_read_some(boost::asio::buffer(buf, bufsize),
+              boost::bind(&ClientSession::OnRead, shared_from_this(),
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+        #endif
 
     }
+    else LogManager::Warning("Failed to prepare the receive block for reading incoming data.");
 
 }
 
-void ClientSession::InternalProcessIncoming(bool& isnothing)
+bool ClientSession::PrepareReadBlock()
 {
-    bool emptyreadlist = false;
+    if(!m_readblock || !m_readblock->data()) return false;
 
-    while(!emptyreadlist)
+    // nobody else is using the block, so just start from the head again if all data has been consumed
+    if(m_readstart >= m_readend && m_readblock.use_count() == 1)
     {
-        IoBufferPtr taskdata;
+        m_readstart = 0;
+        m_readend = 0;
+    }
+
+    int capacity = m_readblock->size();
+    if(capacity - m_readend >= m_readbufsize) return true;
 
-        if(!emptyreadlist)
+    int leftsize = m_readend - m_readstart;
+
+    int blocksize = m_readbufsize * ESN_READ_BLOCK_FACTOR;
+    if(leftsize + m_readbufsize > blocksize)
+    {
+        // a large message is coming, grow the block geometrically
+        blocksize = capacity * 2;
+        if(blocksize < leftsize + m_readbufsize) blocksize = leftsize + m_readbufsize;
+        if(blocksize > ESN_MAX_IOBUF_SIZE) blocksize = ESN_MAX_IOBUF_SIZE;
+        if(blocksize <= leftsize) return false;
+    }
+
+    // the block can be reused only if no extracted message is still sharing it,
+    // and it should not be kept too large after a large message has gone
+    if(m_readblock.use_count() == 1 && capacity >= blocksize && capacity <= blocksize * 2)
+    {
+        if(leftsize > 0 && m_readstart > 0) memmove(m_readblock->data(), m_readblock->data() + m_readstart, leftsize);
+    }
+    else
+    {
+        IoBufferPtr newblock = GetFreeBuffer(blocksize);
+        if(!newblock || !newblock->data() || newblock->size() < blocksize) return false;
+
+        if(leftsize > 0) memcpy(newblock->data(), m_readblock->data() + m_readstart, leftsize);
+
+        // the old block will be released along with the last message which is sharing it
+        if(m_readblock.use_count() == 1 && m_readblock->recyclable()) TakeBack(m_readblock);
+
+        m_readblock = newblock;
+    }
+
+    m_readstart = 0;
+    m_readend = leftsize;
+
+    return true;
+}
+
+bool ClientSession::PauseRead()
+{
+    if(!m_handler || m_state <= 0) return false;
+
+    // mark it first, so a ResumeRead() called by the handler at any time will not be missed
+    m_readpaused = true;
+
+    bool canread = true;
+    try { canread = m_handler->CanRead(shared_from_this()); }
+    catch(...) { LogManager::Warning( "Exception found in CanRead() event." ); }
+
+    if(!canread) return true;
+
+    // if ResumeRead() has been called already, it has started the reading again
+    return !m_readpaused.exchange(false);
+}
+
+void ClientSession::ResumeRead()
+{
+    if(!m_readpaused.exchange(false)) return; // it is reading already
+
+    #ifdef ESN_WITH_SSL
+    if(m_gotssl) m_strand->post(boost::bind(&ClientSession::Read, shared_from_this()));
+    else Read();
+    #else
+    Read();
+    #endif
+}
+
+void ClientSession::InternalProcessIncoming(bool& isnothing)
+{
+    std::vector<IoBufferPtr> batch;
+    SessionPtr current;
+
+    while(true)
+    {
+        // take the messages in order (the ones which are not handled will be put back)
         {
-            if(m_orderlyhandlingread)
-            {
-                boost::unique_lock<boost::mutex> listlock(m_readmutex);
+            boost::unique_lock<boost::mutex> listlock(m_readmutex, boost::defer_lock);
+            if(m_orderlyhandlingread) listlock.lock();
 
-                if (m_readlist.empty())
-                {
-                    emptyreadlist = true;
-                    if(m_closing) // need to check unhandled messages only when closing
-                    {
-                        boost::unique_lock<boost::mutex> lock(m_writemutex);
-                        if (m_writelist.empty()) isnothing = true;
-                    }
-                    break;
-                }
-                else
+            if (m_readlist.empty())
+            {
+                if(m_closing) // need to check unhandled messages only when closing
                 {
-                    taskdata = m_readlist.front();
-                    m_readlist.pop_front();
-                    emptyreadlist = m_readlist.empty();
+                    boost::unique_lock<boost::mutex> lock(m_writemutex);
+                    if (m_writelist.empty()) isnothing = true;
                 }
+                break;
             }
-            else
+
+            int batchsize = m_readlist.size();
+            if(batchsize > ESN_READ_BATCH_SIZE) batchsize = ESN_READ_BATCH_SIZE;
+
+            batch.assign(m_readlist.begin(), m_readlist.begin() + batchsize);
+            m_readlist.erase(m_readlist.begin(), m_readlist.begin() + batchsize);
+        }
+
+        int total = batch.size();
+        int handled = 0;
+        bool wait = false;
+
+        // let the handler take the messages together if it can
+        if(total > 1)
+        {
+            if(!current) current = shared_from_this();
+
+            try { handled = m_handler->OnReadBatch(current, &batch[0], total, wait); }
+            catch(...) { LogManager::Warning( "Exception found in OnReadBatch() event." ); }
+
+            if(handled <= 0) wait = false;
+            if(handled < 0) handled = 0;
+            if(handled > total) handled = total;
+
+            for(int i=0; i<handled; i++)
             {
-                if (m_readlist.empty())
-                {
-                    emptyreadlist = true;
-                    if(m_closing) // need to check unhandled messages only when closing
-                    {
-                        boost::unique_lock<boost::mutex> lock(m_writemutex);
-                        if (m_writelist.empty()) isnothing = true;
-                    }
-                    break;
-                }
-                else
+                // the ones processed in sync are not referenced by others
+                if(batch[i].unique() && batch[i]->recyclable()) TakeBack(batch[i]);
+            }
+
+            if(wait)
+            {
+                // the last one taken is being processed asynchronously without concurrency (see OnRead() below)
+                if(m_orderlyhandlingread) m_asyncreadevents++;
+
+                if(handled < total)
                 {
-                    taskdata = m_readlist.front();
-                    m_readlist.pop_front();
-                    emptyreadlist = m_readlist.empty();
+                    boost::unique_lock<boost::mutex> listlock(m_readmutex, boost::defer_lock);
+                    if(m_orderlyhandlingread) listlock.lock();
+                    m_readlist.insert(m_readlist.begin(), batch.begin() + handled, batch.end());
                 }
-            }
 
+                return;
+            }
         }
 
-        if(taskdata)
+        for(int i=handled; i<total; i++)
         {
+            IoBufferPtr taskdata = batch[i];
+
             int processflags = 0;
             try { processflags = m_handler->OnRead(taskdata->session(), taskdata); }
             catch(...) { LogManager::Warning( "Exception found in OnRead() event." ); }
@@ -1093,7 +1416,16 @@ void ClientSession::InternalProcessIncoming(bool& isnothing)
                     if(m_orderlyhandlingread) m_asyncreadevents++;
                 }
             }
-            break; // wait for next calling
+
+            // wait for next calling, put the rest back (before the newer ones)
+            if(i + 1 < total)
+            {
+                boost::unique_lock<boost::mutex> listlock(m_readmutex, boost::defer_lock);
+                if(m_orderlyhandlingread) listlock.lock();
+                m_readlist.insert(m_readlist.begin(), batch.begin() + i + 1, batch.end());
+            }
+
+            return;
         }
     }
 }
@@ -1146,62 +1478,34 @@ void ClientSession::OnRead(const boost::system::error_code& error, size_t bytes_
 
         int datasize = bytes_transferred;
 
-        m_readbuffer->size(datasize);
-        m_readbuffer->SetReadPos(0);
-        m_readbuffer->SetWritePos(0);
-
-        if(m_readbuffer->size() < datasize)
+        if(m_readend + datasize > m_readblock->size())
         {
             // if there is something wrong, end this round and stop reading more data
             return;
         }
 
+        m_readend += datasize;
+
         std::vector<IoBufferPtr> readylist;
 
+        // the unconsumed data in the receive block, the filter can extract messages from it without copying
+        IoBufferPtr rounddata = CreateIoBufferSlice(m_readblock, m_readstart, m_readend - m_readstart);
+
         if(m_filter)
         {
-            int oldsize = m_roundcache->size();
-            if(oldsize > 0)
-            {
-                int newsize = m_roundcache->size(oldsize + m_readbuffer->size());
-                if(newsize < oldsize + m_readbuffer->size()) return; // there is something wrong about the memory
-                m_roundcache->SetWritePos(oldsize);
-                m_roundcache->PutBuf(m_readbuffer->data(), m_readbuffer->size());
-            }
-            else
-            {
-                int newsize = m_roundcache->size(m_readbuffer->size());
-                if(newsize < m_readbuffer->size()) return; // there is something wrong about the memory
-                m_roundcache->SetWritePos(0);
-                m_roundcache->PutBuf(m_readbuffer->data(), m_readbuffer->size());
-            }
-
-            m_roundcache->SetReadPos(0);
-            m_roundcache->SetWritePos(0);
-
-            bool reset = m_filter->Extract(shared_from_this(), m_roundcache, readylist);
+            bool reset = m_filter->Extract(shared_from_this(), rounddata, readylist);
 
-            if(reset || m_roundcache->size() <= m_roundcache->GetReadPos())
-            {
-                m_roundcache->size(0);
-                m_roundcache->SetReadPos(0);
-                m_roundcache->SetWritePos(0);
-            }
-            else
-            {
-                int leftsize = m_roundcache->size() - m_roundcache->GetReadPos();
-                memcpy(m_roundcache->data(), m_roundcache->data() + m_roundcache->GetReadPos(), leftsize);
-                m_roundcache->size(leftsize);
-                m_roundcache->SetReadPos(0);
-                m_roundcache->SetWritePos(0);
-            }
+            if(reset || rounddata->size() <= rounddata->GetReadPos()) m_readstart = m_readend;
+            else m_readstart += rounddata->GetReadPos();
         }
         else
         {
-            IoBufferPtr rawtask = m_readbuffer;
-            readylist.push_back(rawtask);
+            readylist.push_back(rounddata);
+            m_readstart = m_readend;
         }
 
+        rounddata.reset();
+
         bool fullqueue = false;
         int total = readylist.size();
         if(total > 0)
@@ -1276,6 +1580,10 @@ void ClientSession::OnRead(const boost::system::error_code& error, size_t bytes_
 
         if(total > 0) ProcessIncomingData(false); // process in an orderly way by default
 
+        readylist.clear(); // so the receive block may be reused if the messages have been handled already
+
+        if(PauseRead()) return; // the handler is too busy to take more data, stop reading until it is resumed
+
         #ifdef ESN_WITH_SSL
         if(m_gotssl) m_strand->post(boost::bind(&ClientSession::Read, shared_from_this()));
         else Read();
@@ -1305,25 +1613,42 @@ void ClientSession::OnWrite(const boost::system::error_code& error, size_t bytes
 {
     //std::cout << "\nOnWrite " << std::endl;
 
+    // remove all the buffers of the write (they are done, or failed together)
+    std::vector<IoBufferPtr> donelist;
+    int change = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(m_writemutex);
+        int bytes = 0;
+        for(int i=0; i<m_writingcount && !m_writelist.empty(); i++)
+        {
+            IoBufferPtr task = m_writelist.front();
+            if(task) bytes += task->size();
+            donelist.push_back(task);
+            m_writelist.pop_front();
+        }
+        m_writingcount = 0;
+        change = UpdateWriteQueueBytes(-bytes);
+    }
+
+    NotifyWriteState(change); // the peer is taking the data again, the writers can go on
+
     if (!error)
     {
         m_lastwritetime = boost::posix_time::second_clock::local_time();
 
-        int processflags = 0;
+        int asyncevents = 0;
 
-        IoBufferPtr taskdata;
-        if(!taskdata)
-        {
-            boost::unique_lock<boost::mutex> lock(m_writemutex);
-            taskdata = m_writelist.front();
-        }
+        SessionPtr current = shared_from_this();
 
-        if(taskdata)
+        int total = donelist.size();
+        for(int i=0; i<total; i++)
         {
-            if(m_handler)
+            int processflags = 0;
+
+            IoBufferPtr taskdata = donelist[i];
+
+            if(taskdata && m_handler)
             {
-                SessionPtr current = shared_from_this();
-                taskdata->size(bytes_transferred);
                 taskdata->SetReadPos(0);
                 taskdata->SetWritePos(0);
                 taskdata->type(2); // "2" stands for outgoing data
@@ -1331,29 +1656,28 @@ void ClientSession::OnWrite(const boost::system::error_code& error, size_t bytes
                 try { processflags = m_handler->OnWrite(current, taskdata); }
                 catch(...) { LogManager::Warning( "Exception found in OnWrite() event." ); }
             }
+
+            if((processflags & 1) == 0) // if it is in-sync process
+            {
+                if(taskdata && taskdata->recyclable()) TakeBack(taskdata);
+            }
+            else if((processflags & 2) == 0) // if it is async process without concurrency
+            {
+                asyncevents++;
+            }
         }
 
-        if((processflags & 1) == 0) // if it is in-sync process
+        if(asyncevents == 0)
         {
-            if(taskdata && taskdata->recyclable()) TakeBack(taskdata);
-
             // continue to process the rest
             ProcessOutgoingData(false);
         }
-        else // if it is async process
+        else
         {
-            if((processflags & 2) != 0) // if it supports concurrency
+            if(m_orderlyhandlingwrite)
             {
-                // continue to process the rest
-                ProcessOutgoingData(false);
-            }
-            else
-            {
-                if(m_orderlyhandlingwrite)
-                {
-                    boost::unique_lock<boost::mutex> processlock(m_processwritemutex);
-                    m_asyncwriteevents++;
-                }
+                boost::unique_lock<boost::mutex> processlock(m_processwritemutex);
+                m_asyncwriteevents += asyncevents;
             }
         }
     }
@@ -1365,7 +1689,14 @@ void ClientSession::OnWrite(const boost::system::error_code& error, size_t bytes
             catch(...) { LogManager::Warning( "Exception found in OnError() event." ); }
         }
 
-        // continue to process the rest (including the failed one)
+        int total = donelist.size();
+        for(int i=0; i<total; i++)
+        {
+            IoBufferPtr taskdata = donelist[i];
+            if(taskdata && taskdata->recyclable()) TakeBack(taskdata);
+        }
+
+        // continue to process the rest
         ProcessOutgoingData(false);
     }
 }
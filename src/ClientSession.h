@@ -40,6 +40,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
 #include <boost/asio.hpp>
 
 #ifdef ESN_WITH_SSL
@@ -51,6 +52,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "IoBuffer.h"
 #include "IoFilter.h"
 #include "IoHandler.h"
+#include "IoService.h"
 #include "IoBufferManager.h"
 
 #include "Session.h"
@@ -60,6 +62,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define ESN_DEFAULT_SOCK_BUFSIZE 8192
 #endif
 
+#ifndef ESN_READ_BLOCK_FACTOR
+#define ESN_READ_BLOCK_FACTOR 4
+#endif
+
+#ifndef ESN_READ_BATCH_SIZE
+#define ESN_READ_BATCH_SIZE 64
+#endif
+
+#ifndef ESN_WRITE_SEGMENT_SIZE
+#define ESN_WRITE_SEGMENT_SIZE (1024 * 1024)
+#endif
+
+#ifndef ESN_MAX_GATHER_WRITE_COUNT
+#define ESN_MAX_GATHER_WRITE_COUNT 64
+#endif
+
+#ifndef ESN_MAX_GATHER_WRITE_BYTES
+#define ESN_MAX_GATHER_WRITE_BYTES (256 * 1024)
+#endif
+
+#ifndef ESN_WRITE_HIGH_WATERMARK
+#define ESN_WRITE_HIGH_WATERMARK (1024 * 1024)
+#endif
+
+#ifndef ESN_WRITE_LOW_WATERMARK
+#define ESN_WRITE_LOW_WATERMARK (256 * 1024)
+#endif
+
 namespace esnlib
 {
 
@@ -96,12 +126,17 @@ public:
     /// @param data The data (a buffer pointer)
     virtual void Write(boost::shared_ptr<IoBuffer> data);
 
-    /// Write buffer to the other side
+    /// Write buffer to the other side (large buffer will be copied into chained segments)
     ///
     /// @param buf The buffer (a char pointer)
     /// @param bufsize The size of the buffer
     virtual void Write(const char* buf, int bufsize);
 
+    /// Write data made up of chained segments to the other side
+    ///
+    /// @param chain The segments (buffer pointers)
+    virtual void Write(const std::vector< boost::shared_ptr<IoBuffer> >& chain);
+
     /// Write data to the other side
     ///
     /// @param data The data (a common pointer)
@@ -185,6 +220,43 @@ public:
     /// @param value The max message queue size
     virtual void SetMaxMessageQueueSize(int optype, int value);
 
+    /// Get the limit of gather-write (queued buffers will be sent out together in one write)
+    ///
+    /// @param limittype The limit type: 1 for max number of the buffers, 2 for max total bytes
+    /// @return The limit value
+    virtual int GetGatherWriteLimit(int limittype);
+
+    /// Set the limit of gather-write (queued buffers will be sent out together in one write)
+    ///
+    /// @param limittype The limit type: 1 for max number of the buffers, 2 for max total bytes
+    /// @param value The limit value ("1" buffer means no gather-write)
+    virtual void SetGatherWriteLimit(int limittype, int value);
+
+    /// Get the watermark of the outgoing data queued (the ones being sent included)
+    ///
+    /// @param marktype The watermark type: 1 for high, 2 for low
+    /// @return The watermark value (in bytes)
+    virtual int GetWriteWatermark(int marktype);
+
+    /// Set the watermark of the outgoing data queued, the session is blocked (see IsWritable()) when the data
+    /// reaches the high watermark, and it will be writable again when the data falls below the low watermark
+    ///
+    /// @param marktype The watermark type: 1 for high, 2 for low
+    /// @param value The watermark value (in bytes, "0" high watermark means never blocked)
+    virtual void SetWriteWatermark(int marktype, int value);
+
+    /// Get total bytes of the outgoing data queued (the ones being sent included)
+    ///
+    /// @return The total bytes
+    virtual int GetWriteQueueBytes();
+
+    /// Check whether the session is writable (the outgoing data queued has not reached the high watermark).
+    /// A session which is not writable still takes new data (till the max message queue size),
+    /// but the writer should wait for the OnWritable() event of the IO handler
+    ///
+    /// @return Return true if the session is writable
+    virtual bool IsWritable();
+
     /// Get the session's state
     ///
     /// @return The session state
@@ -248,6 +320,18 @@ public:
     /// @return The pointer of the local data
     virtual CommonDataPtr GetData();
 
+    /// Get the state of an IO filter kept in the session (see IoFilter::GetSessionState())
+    ///
+    /// @param slot The state slot of the IO filter
+    /// @return The pointer of the state (empty if it is not set yet)
+    virtual BusinessPtr GetFilterState(int slot);
+
+    /// Set the state of an IO filter kept in the session (it will be released with the session)
+    ///
+    /// @param slot The state slot of the IO filter
+    /// @param state The pointer of the state
+    virtual void SetFilterState(int slot, BusinessPtr state);
+
     /// Check whether the session has global data attached
     ///
     /// @return Return true if the session has global data
@@ -278,6 +362,9 @@ public:
     /// @return The port of the local side
     virtual int GetLocalPort();
 
+    /// Resume reading incoming data, if the session has stopped reading because its IO handler asked it to wait
+    virtual void ResumeRead();
+
     /// Process incoming data
     ///
     /// @param asynccall It is an async call or not
@@ -303,6 +390,11 @@ public:
     /// @param manager The pointer of the buffer manager
     void SetBufferManager(IoBufferManagerPtr manager);
 
+    /// Set the IO service which the session is running on (to let it count live sessions)
+    ///
+    /// @param service The pointer of the IO service
+    void SetIoService(IoServicePtr service);
+
     /// Process read operation
     void Read();
 
@@ -339,6 +431,30 @@ protected:
     /// The process which will be execute once the connection is established.
     void AfterConnect();
 
+    /// Stop counting the session as a live session of its IO service
+    void ReleaseIoService();
+
+    /// Make sure there is enough free space at the tail of the receive block for the next read
+    ///
+    /// @return Return true if the receive block is ready
+    bool PrepareReadBlock();
+
+    /// Ask the IO handler whether the session can go on reading (see IoHandler::CanRead())
+    ///
+    /// @return Return true if the session should stop reading now (it will be resumed by ResumeRead())
+    bool PauseRead();
+
+    /// Count the outgoing data added (or sent out if the bytes are negative), it must be called with lock(m_writemutex)
+    ///
+    /// @param bytes The bytes added
+    /// @return 1 if the session has just been blocked, 2 if it has just become writable, 0 for no change
+    int UpdateWriteQueueBytes(int bytes);
+
+    /// Fire the OnWriteBlocked() or OnWritable() event of the IO handler (it must be called without lock(m_writemutex))
+    ///
+    /// @param change The change returned by UpdateWriteQueueBytes()
+    void NotifyWriteState(int change);
+
 private:
 
     int m_id;
@@ -351,6 +467,8 @@ private:
     int m_asyncreadevents;
     int m_asyncwriteevents;
 
+    boost::atomic<bool> m_readpaused; // whether the reading has stopped and is waiting for ResumeRead()
+
     bool m_closing;
 
     bool m_gotssl;
@@ -363,6 +481,19 @@ private:
     int m_maxreadqueuesize;
     int m_maxwritequeuesize;
 
+    int m_maxgathercount;
+    int m_maxgatherbytes;
+
+    bool m_writing;     // whether the write chain is running (a write is in flight or waiting to go on)
+    int m_writingcount; // how many buffers (at the front of m_writelist) the write in flight has
+
+    int m_writequeuebytes; // total bytes of m_writelist
+    int m_highwatermark;
+    int m_lowwatermark;
+    bool m_writeblocked; // whether the queued data has reached the high watermark (and not fallen below the low one yet)
+    bool m_notifiedblocked; // the last state reported to the IO handler
+    bool m_notifyingwrite;  // whether a thread is firing the events of the write state
+
     int m_remoteport;
     std::string m_remoteip;
 
@@ -401,12 +532,15 @@ private:
     std::map<int, BusinessPtr> m_dataintobjmap;
     std::map<std::string, BusinessPtr> m_datastrobjmap;
 
+    std::vector<BusinessPtr> m_filterstates; // the states of the IO filters (by their state slots), with lock(m_datamutex)
+
     SessionManager& m_mgr;
 
-    IoBufferPtr m_readbuffer;
+    IoBufferPtr m_readblock; // the receive block, extracted messages are parts of it (share its memory)
+    int m_readstart;         // where the unconsumed data begins in the receive block
+    int m_readend;           // where the unconsumed data ends in the receive block
 
     IoBufferPtr m_readcache;
-    IoBufferPtr m_roundcache;
 
     IoBufferQueue m_readlist;
     IoBufferQueue m_writelist;
@@ -417,10 +551,14 @@ private:
 
     IoBufferManagerPtr m_bufmgr;
 
+    IoServicePtr m_service;
+    bool m_servicecounted;
+
     void InternalProcessIncoming(bool& isnothing);
     void InternalProcessOutgoing(bool& isnothing);
 
     void InternalWrite();
+    void InternalSafeWrite();
     void InternalShutdown();
 };
 
@@ -0,0 +1,306 @@
+/*
+-----------------------------------------------------------------------------
+This source file is part of "esnetwork" library.
+It is licensed under the terms of the BSD license.
+For the latest info, see http://esnetwork.sourceforge.net
+
+Copyright (c) 2012-2013 Lin Jia Jun (Joe Lam)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------------
+*/
+
+#include <cstring>
+#include <sstream>
+
+#include <boost/thread/tss.hpp>
+
+#include "LogManager.h"
+
+#include "CompressionFilter.h"
+
+#ifdef ESN_WITH_ZLIB
+
+#include <zlib.h>
+
+namespace esnlib
+{
+
+/// The zlib streams of a thread (raw deflate, no zlib header and checksum in the message)
+///
+/// They are shared by all compression filters used in the thread, and will be reset for every message.
+class CompressionStreams
+{
+public:
+
+    CompressionStreams(int level): m_level(level)
+    {
+        memset(&m_deflater, 0, sizeof(m_deflater));
+        memset(&m_inflater, 0, sizeof(m_inflater));
+        m_deflateready = deflateInit2(&m_deflater, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        m_inflateready = inflateInit2(&m_inflater, -MAX_WBITS) == Z_OK;
+    }
+
+    ~CompressionStreams()
+    {
+        if(m_deflateready) deflateEnd(&m_deflater);
+        if(m_inflateready) inflateEnd(&m_inflater);
+    }
+
+    z_stream m_deflater;
+    z_stream m_inflater;
+
+    bool m_deflateready;
+    bool m_inflateready;
+
+    int m_level; // current compression level of the deflater
+};
+
+static boost::thread_specific_ptr<CompressionStreams> thread_streams;
+
+}
+
+using namespace esnlib;
+
+CompressionFilter::CompressionFilter(int headerSize, int bodySizePos, int bodySizeLength, int flagPos, int flagMask,
+                                     int threshold, int maxBodySize)
+{
+    m_headersize = headerSize;
+    m_bodysizepos = bodySizePos;
+    m_bodysizelen = bodySizeLength;
+    m_flagpos = flagPos;
+    m_flagmask = flagMask & 0xff;
+    m_threshold = threshold;
+    m_maxbodysize = maxBodySize;
+    m_level = ESN_COMPRESSION_LEVEL;
+
+    if(m_headersize < 1) m_headersize = 1;
+    if(m_bodysizelen != 1 && m_bodysizelen != 2) m_bodysizelen = 4;
+    if(m_bodysizelen > m_headersize) m_bodysizelen = m_headersize;
+    if(m_bodysizepos < 0 || m_bodysizepos > m_headersize - m_bodysizelen) m_bodysizepos = 0;
+    if(m_flagpos < 0 || m_flagpos >= m_headersize) m_flagpos = m_headersize - 1;
+    if(m_threshold < 1) m_threshold = 1;
+    if(m_maxbodysize < 0) m_maxbodysize = 0;
+
+    if(m_flagpos >= m_bodysizepos && m_flagpos < m_bodysizepos + m_bodysizelen)
+        LogManager::Warning("The flag bit of CompressionFilter is in the body size of the message header.");
+}
+
+CompressionFilter::~CompressionFilter()
+{
+    //dtor
+}
+
+void CompressionFilter::SetDictionary(const std::string& dictionary)
+{
+    m_dictionary = dictionary;
+}
+
+void CompressionFilter::SetLevel(int level)
+{
+    if(level < 1) level = 1;
+    if(level > 9) level = 9;
+    m_level = level;
+}
+
+CompressionStreams* CompressionFilter::GetStreams()
+{
+    int level = m_level;
+    CompressionStreams* streams = thread_streams.get();
+    if(!streams)
+    {
+        streams = new CompressionStreams(level);
+        thread_streams.reset(streams);
+    }
+    else if(streams->m_level != level && streams->m_deflateready)
+    {
+        // the streams are reset for every message, so there is no pending output to flush
+        deflateReset(&streams->m_deflater);
+        if(deflateParams(&streams->m_deflater, level, Z_DEFAULT_STRATEGY) == Z_OK) streams->m_level = level;
+        else LogManager::Warning("Failed to change the compression level of zlib.");
+    }
+    return streams;
+}
+
+IoBufferPtr CompressionFilter::NewBuffer(SessionPtr session, int bufsize)
+{
+    IoBufferPtr buf;
+    if(session) buf = session->GetFreeBuffer(bufsize);
+    else buf = CreateIoBuffer(bufsize);
+    if(buf && buf->size() != bufsize) buf->size(bufsize);
+    if(buf && buf->size() != bufsize) buf.reset();
+    return buf;
+}
+
+IoBufferPtr CompressionFilter::PassThrough(SessionPtr session, IoBuffer* buf)
+{
+    IoBufferPtr newtask;
+    if(buf->IsSlice())
+    {
+        // a slice can be sent as another slice of the same memory (no copy)
+        newtask = CreateIoBufferSlice(buf->GetSource(), buf->GetOffset(), buf->size());
+        return newtask;
+    }
+    newtask = NewBuffer(session, buf->size());
+    if(newtask) memcpy(newtask->data(), buf->data(), buf->size());
+    return newtask;
+}
+
+void CompressionFilter::SetBodySize(IoBuffer* buf, int bodysize)
+{
+    // the same byte order as MessageCodec (the byte order of current machine)
+    char* pos = buf->data() + m_bodysizepos;
+    if(m_bodysizelen == 1) { char value = bodysize; memcpy(pos, &value, 1); }
+    else if(m_bodysizelen == 2) { short value = bodysize; memcpy(pos, &value, 2); }
+    else { int value = bodysize; memcpy(pos, &value, 4); }
+}
+
+bool CompressionFilter::Extract(SessionPtr session, IoBufferPtr data, std::vector<IoBufferPtr>& readylist)
+{
+    // the incoming data should be a whole message, it will be handled at once
+    data->SetReadPos(data->size());
+
+    if(data->size() < m_headersize) return true;
+
+    if((data->data()[m_flagpos] & m_flagmask) == 0)
+    {
+        readylist.push_back(data); // not compressed
+        return true;
+    }
+
+    int bodylen = data->size() - m_headersize;
+    if(bodylen < 4)
+    {
+        LogManager::Warning("Found a broken compressed message.");
+        return true;
+    }
+
+    const unsigned char* body = (const unsigned char*)(data->data() + m_headersize);
+    unsigned int orgbodylen = ((unsigned int)body[0] << 24) | ((unsigned int)body[1] << 16)
+                              | ((unsigned int)body[2] << 8) | (unsigned int)body[3];
+    if(orgbodylen > (unsigned int)m_maxbodysize)
+    {
+        std::stringstream ss;
+        ss << "The size of a compressed message is too large: " << orgbodylen;
+        LogManager::Warning(ss.str());
+        return true;
+    }
+
+    CompressionStreams* streams = GetStreams();
+    if(!streams || !streams->m_inflateready)
+    {
+        LogManager::Warning("Failed to init zlib for decompressing message.");
+        return true;
+    }
+
+    IoBufferPtr newtask = NewBuffer(session, m_headersize + orgbodylen);
+    if(!newtask)
+    {
+        LogManager::Warning("Failed to get free buffer for decompressing message.");
+        return true;
+    }
+
+    z_stream& inflater = streams->m_inflater;
+    inflateReset(&inflater);
+    if(m_dictionary.length() > 0)
+        inflateSetDictionary(&inflater, (const Bytef*)m_dictionary.data(), m_dictionary.length());
+
+    inflater.next_in = (Bytef*)(body + 4);
+    inflater.avail_in = bodylen - 4;
+    inflater.next_out = (Bytef*)(newtask->data() + m_headersize);
+    inflater.avail_out = orgbodylen;
+
+    int rc = inflate(&inflater, Z_FINISH);
+    if(rc != Z_STREAM_END || inflater.avail_out != 0)
+    {
+        LogManager::Warning("Failed to decompress message.");
+        if(session) session->TakeBack(newtask);
+        return true;
+    }
+
+    memcpy(newtask->data(), data->data(), m_headersize);
+    newtask->data()[m_flagpos] &= ~m_flagmask;
+    SetBodySize(newtask.get(), orgbodylen);
+
+    readylist.push_back(newtask);
+
+    return true;
+}
+
+IoBufferPtr CompressionFilter::Encode(SessionPtr session, void* data)
+{
+    IoBufferPtr newtask;
+    IoBuffer* buf = (IoBuffer*)data;
+    if(!buf) return newtask;
+
+    int bodylen = buf->size() - m_headersize;
+    if(bodylen < m_threshold) return PassThrough(session, buf);
+
+    CompressionStreams* streams = GetStreams();
+    if(!streams || !streams->m_deflateready) return PassThrough(session, buf);
+
+    z_stream& deflater = streams->m_deflater;
+    deflateReset(&deflater);
+    if(m_dictionary.length() > 0)
+        deflateSetDictionary(&deflater, (const Bytef*)m_dictionary.data(), m_dictionary.length());
+
+    int bound = deflateBound(&deflater, bodylen);
+    newtask = NewBuffer(session, m_headersize + 4 + bound);
+    if(!newtask) return PassThrough(session, buf);
+
+    deflater.next_in = (Bytef*)(buf->data() + m_headersize);
+    deflater.avail_in = bodylen;
+    deflater.next_out = (Bytef*)(newtask->data() + m_headersize + 4);
+    deflater.avail_out = bound;
+
+    int rc = deflate(&deflater, Z_FINISH);
+    int zipsize = bound - deflater.avail_out;
+
+    // send the original one if it can not be smaller
+    if(rc != Z_STREAM_END || zipsize + 4 >= bodylen)
+    {
+        if(session) session->TakeBack(newtask);
+        return PassThrough(session, buf);
+    }
+
+    memcpy(newtask->data(), buf->data(), m_headersize);
+    newtask->data()[m_flagpos] |= m_flagmask;
+    SetBodySize(newtask.get(), zipsize + 4);
+
+    unsigned char* body = (unsigned char*)(newtask->data() + m_headersize);
+    body[0] = (bodylen >> 24) & 0xff;
+    body[1] = (bodylen >> 16) & 0xff;
+    body[2] = (bodylen >> 8) & 0xff;
+    body[3] = bodylen & 0xff;
+
+    newtask->size(m_headersize + 4 + zipsize);
+
+    return newtask;
+}
+
+void* CompressionFilter::Decode(SessionPtr session, IoBufferPtr data)
+{
+    if(data) return (void*)(data.get());
+    else return NULL;
+}
+
+#endif // ESN_WITH_ZLIB
@@ -0,0 +1,150 @@
+/*
+-----------------------------------------------------------------------------
+This source file is part of "esnetwork" library.
+It is licensed under the terms of the BSD license.
+For the latest info, see http://esnetwork.sourceforge.net
+
+Copyright (c) 2012-2013 Lin Jia Jun (Joe Lam)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _ESN_COMPRESSIONFILTER_H_
+#define _ESN_COMPRESSIONFILTER_H_
+
+#ifdef ESN_WITH_ZLIB
+
+#include <string>
+
+#include <boost/atomic.hpp>
+
+#include "IoFilter.h"
+
+#ifndef ESN_COMPRESSION_THRESHOLD
+#define ESN_COMPRESSION_THRESHOLD 256
+#endif
+
+#ifndef ESN_COMPRESSION_LEVEL
+#define ESN_COMPRESSION_LEVEL 6
+#endif
+
+namespace esnlib
+{
+
+class CompressionStreams;
+
+/// Compression Filter class, a filter who compresses the body of a common message(format: header + body) with zlib
+///
+/// It works on whole messages, so please put it after a codec (e.g. MessageCodec) in an IoFilterChain.
+/// A message whose body is not smaller than the threshold will be compressed when it is written,
+/// and a flag bit in its header will be set. The compressed body begins with the original body size
+/// (4 bytes, big-endian) and then the deflated data, and the body size in the header will be updated.
+/// A message without the flag bit will be passed through without copying.
+/// Incoming compressed messages will be decompressed into free buffers got from the session (the memory pool).
+class CompressionFilter : public IoFilter
+{
+public:
+
+    /// Constructor function
+    ///
+    /// @param headerSize The size(how many bytes) of the message header
+    /// @param bodySizePos The position of the body size in the message header
+    /// @param bodySizeLength The size(how many bytes) of the body size in the message header
+    /// @param flagPos The position of the byte (in the message header) where the flag bit is
+    /// @param flagMask The flag bit (e.g. 0x01)
+    /// @param threshold The min body size of a message to be compressed
+    /// @param maxBodySize The max body size of a message after it is decompressed
+    CompressionFilter(int headerSize, int bodySizePos, int bodySizeLength, int flagPos, int flagMask,
+                      int threshold = ESN_COMPRESSION_THRESHOLD, int maxBodySize = 1024);
+
+    /// Destructor function
+    virtual ~CompressionFilter();
+
+    /// Set the preset dictionary (both sides must use the same one)
+    ///
+    /// It helps a lot with small messages which have common words (e.g. the keys of JSON messages).
+    /// Please set it before the filter is used by any session.
+    ///
+    /// @param dictionary The preset dictionary (empty for none)
+    void SetDictionary(const std::string& dictionary);
+
+    /// Set the compression level
+    ///
+    /// It can be changed at any time, and will be used by the messages encoded after it.
+    ///
+    /// @param level The compression level (1 is the fastest one, 9 is the best one)
+    void SetLevel(int level);
+
+    /// Extract useful data (the message decompressed) from the message
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the message (header + body)
+    /// @param readylist The list used to save the useful data extracted
+    /// @return Return true if the message has been handled
+    virtual bool Extract(SessionPtr session, IoBufferPtr data, std::vector<IoBufferPtr>& readylist);
+
+    /// Encode the raw buffer
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the raw buffer (an IO buffer with the whole message)
+    /// @return The pointer of the IO buffer encoded (compressed if its body is large enough)
+    virtual IoBufferPtr Encode(SessionPtr session, void* data);
+
+    /// Decode the IO buffer
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the IO buffer encoded
+    /// @return The original raw buffer (a common pointer)
+    virtual void* Decode(SessionPtr session, IoBufferPtr data);
+
+protected:
+private:
+
+    CompressionStreams* GetStreams();
+
+    IoBufferPtr NewBuffer(SessionPtr session, int bufsize);
+    IoBufferPtr PassThrough(SessionPtr session, IoBuffer* buf);
+
+    void SetBodySize(IoBuffer* buf, int bodysize);
+
+    int m_headersize;
+    int m_bodysizepos;
+    int m_bodysizelen;
+    int m_flagpos;
+    int m_flagmask;
+    int m_threshold;
+    int m_maxbodysize;
+
+    boost::atomic<int> m_level;
+
+    std::string m_dictionary;
+
+};
+
+typedef boost::shared_ptr<CompressionFilter> CompressionFilterPtr;
+
+}
+
+#endif // ESN_WITH_ZLIB
+
+#endif // _ESN_COMPRESSIONFILTER_H_
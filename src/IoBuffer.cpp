@@ -33,15 +33,80 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <cstdlib>
 #include <cstring>
 
+#include <new>
+
+#include <boost/make_shared.hpp>
+
 #include "IoBuffer.h"
 
 using namespace esnlib;
 
+namespace
+{
+
+// Allocate the memory for the object (with its reference count) and some extra bytes after it in one block,
+// and tell where the extra bytes are
+template <class T>
+class IoBufferBlockAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <class U> struct rebind { typedef IoBufferBlockAllocator<U> other; };
+
+    IoBufferBlockAllocator(int extra, char** extradata): m_extra(extra), m_extradata(extradata) {}
+
+    template <class U>
+    IoBufferBlockAllocator(const IoBufferBlockAllocator<U>& other): m_extra(other.m_extra), m_extradata(other.m_extradata) {}
+
+    T* allocate(std::size_t n, const void* hint = 0)
+    {
+        std::size_t headsize = GetHeadSize(n);
+        char* block = (char*)::operator new(headsize + m_extra);
+        if(m_extradata) *m_extradata = block + headsize;
+        return (T*)block;
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        ::operator delete((void*)p);
+    }
+
+    template <class U> void construct(U* p, const U& value) { new((void*)p) U(value); }
+    template <class U> void destroy(U* p) { p->~U(); }
+
+    std::size_t max_size() const { return std::size_t(-1) / sizeof(T); }
+
+    bool operator==(const IoBufferBlockAllocator& other) const { return true; }
+    bool operator!=(const IoBufferBlockAllocator& other) const { return false; }
+
+    int m_extra;
+    char** m_extradata;
+
+private:
+    static std::size_t GetHeadSize(std::size_t n)
+    {
+        std::size_t headsize = n * sizeof(T);
+        std::size_t alignsize = sizeof(double) * 2;
+        return (headsize + alignsize - 1) / alignsize * alignsize;
+    }
+};
+
+}
+
 IoBuffer::IoBuffer()
 :m_size(ESN_DEFAULT_IOBUF_SIZE)
 ,m_max(ESN_DEFAULT_IOBUF_SIZE)
 {
     m_data = (char*)malloc(ESN_DEFAULT_IOBUF_SIZE);
+    m_ownsdata = true;
+    m_offset = 0;
     m_flag = 0;
     m_code = 0;
     m_type = 0;
@@ -60,8 +125,10 @@ IoBuffer::IoBuffer()
     //printf("Begin IoTask: %d\n", (int)this);
 }
 
-IoBuffer::IoBuffer(int size)
+IoBuffer::IoBuffer(int size, bool exactcapacity)
 {
+    m_offset = 0;
+
     m_size = size;
     if(m_size < 0) m_size = 0;
 
@@ -70,16 +137,25 @@ IoBuffer::IoBuffer(int size)
         m_size = ESN_MAX_IOBUF_SIZE;
         size = ESN_MAX_IOBUF_SIZE;
     }
-    else
+    else if(m_size > ESN_IOBUF_INLINE_SIZE && !exactcapacity)
     {
         int leftsize = m_size % ESN_DEFAULT_IOBUF_SIZE;
         if(leftsize > 0) m_size = m_size + ESN_DEFAULT_IOBUF_SIZE - leftsize;
     }
 
-    m_max = m_size;
-
-    if(m_size > 0) m_data = (char*)malloc(m_size);
-    else m_data = NULL;
+    if(m_size <= ESN_IOBUF_INLINE_SIZE)
+    {
+        // small data will be kept in the object itself
+        m_max = ESN_IOBUF_INLINE_SIZE;
+        m_data = m_inline;
+        m_ownsdata = false;
+    }
+    else
+    {
+        m_max = m_size;
+        m_data = (char*)malloc(m_size);
+        m_ownsdata = true;
+    }
 
     m_size = size;
     if(m_size < 0) m_size = 0;
@@ -107,26 +183,38 @@ IoBuffer::IoBuffer(int size)
 
 IoBuffer::IoBuffer(const char* buf, int bufsize)
 {
+    m_offset = 0;
+
+    if(bufsize < 0) bufsize = 0;
+
     m_size = bufsize;
-    if(m_size < 0) m_size = 0;
 
     if(m_size > ESN_MAX_IOBUF_SIZE)
     {
         m_size = ESN_MAX_IOBUF_SIZE;
         bufsize = ESN_MAX_IOBUF_SIZE;
     }
-    else
+    else if(m_size > ESN_IOBUF_INLINE_SIZE)
     {
         int leftsize = m_size % ESN_DEFAULT_IOBUF_SIZE;
         if(leftsize > 0) m_size = m_size + ESN_DEFAULT_IOBUF_SIZE - leftsize;
     }
 
-    m_max = m_size;
-
-    if(m_size > 0) m_data = (char*)malloc(m_size);
-    else m_data = NULL;
+    if(m_size <= ESN_IOBUF_INLINE_SIZE)
+    {
+        // small data will be kept in the object itself
+        m_max = ESN_IOBUF_INLINE_SIZE;
+        m_data = m_inline;
+        m_ownsdata = false;
+    }
+    else
+    {
+        m_max = m_size;
+        m_data = (char*)malloc(m_size);
+        m_ownsdata = true;
+    }
 
-    if(m_data && buf) memcpy(m_data, buf, bufsize);
+    if(m_data && buf && bufsize > 0) memcpy(m_data, buf, bufsize);
 
     m_size = bufsize;
     if(m_size < 0) m_size = 0;
@@ -155,16 +243,27 @@ IoBuffer::IoBuffer(const char* buf, int bufsize)
 
 IoBuffer::IoBuffer(const IoBuffer& src)
 {
+    m_offset = 0;
+
     m_size = src.m_size;
     if(m_size < 0) m_size = 0;
 
-    int leftsize = m_size % ESN_DEFAULT_IOBUF_SIZE;
-    if(leftsize > 0) m_size = m_size + ESN_DEFAULT_IOBUF_SIZE - leftsize;
-
-    m_max = m_size;
+    if(m_size <= ESN_IOBUF_INLINE_SIZE)
+    {
+        // small data will be kept in the object itself
+        m_max = ESN_IOBUF_INLINE_SIZE;
+        m_data = m_inline;
+        m_ownsdata = false;
+    }
+    else
+    {
+        int leftsize = m_size % ESN_DEFAULT_IOBUF_SIZE;
+        if(leftsize > 0) m_size = m_size + ESN_DEFAULT_IOBUF_SIZE - leftsize;
 
-    if(m_size > 0) m_data = (char*)malloc(m_size);
-    else m_data = NULL;
+        m_max = m_size;
+        m_data = (char*)malloc(m_size);
+        m_ownsdata = true;
+    }
 
     if(m_data && src.m_data) memcpy(m_data, src.m_data, src.m_size);
 
@@ -193,9 +292,47 @@ IoBuffer::IoBuffer(const IoBuffer& src)
 
 }
 
+IoBuffer::IoBuffer(boost::shared_ptr<IoBuffer> source, int offset, int len)
+{
+    m_data = NULL;
+    m_ownsdata = false;
+    m_offset = 0;
+
+    m_size = 0;
+    m_max = 0;
+
+    m_flag = 0;
+    m_code = 0;
+    m_type = 0;
+    m_state = 0;
+
+    m_default = 0;
+
+    m_readpos = 0;
+    m_writepos = 0;
+
+    m_recyclable = false;
+
+    if(source && source->m_data)
+    {
+        if(offset < 0) offset = 0;
+        if(offset > source->m_size) offset = source->m_size;
+        if(len < 0 || offset + len > source->m_size) len = source->m_size - offset;
+
+        // always keep the real owner of the memory, so a part of a part will not hold the middle one
+        m_source = source->m_source ? source->m_source : source;
+        m_offset = source->m_offset + offset;
+
+        m_data = source->m_data + offset;
+
+        m_size = len;
+        m_max = len;
+    }
+}
+
 IoBuffer::~IoBuffer()
 {
-    if (m_data) free(m_data);
+    if (m_data && m_ownsdata) free(m_data);
     //printf("End IoTask: %d\n", (int)this);
 }
 
@@ -253,6 +390,16 @@ int IoBuffer::size() const
     return m_size;
 }
 
+int IoBuffer::datasize() const
+{
+    return m_size;
+}
+
+int IoBuffer::capacity() const
+{
+    return m_max;
+}
+
 int IoBuffer::size(int value)
 {
     if(value < 0) return m_size;
@@ -265,21 +412,36 @@ int IoBuffer::size(int value)
     {
         int newsize = value;
 
+        // grow its own memory geometrically, so growing step by step will not copy the data again and again
+        // (a slice or a buffer with fixed memory just moves to the memory of its own)
+        if(m_ownsdata && newsize < m_max * 2 && m_max <= ESN_MAX_IOBUF_SIZE / 2) newsize = m_max * 2;
+
         int leftsize = newsize % ESN_DEFAULT_IOBUF_SIZE;
         if(leftsize > 0) newsize = newsize + ESN_DEFAULT_IOBUF_SIZE - leftsize;
+        if(newsize > ESN_MAX_IOBUF_SIZE) newsize = ESN_MAX_IOBUF_SIZE;
 
         //printf("calling realloc(): %d(%d) => %d(%d) \n", m_size, m_max, value, newsize);
 
         char* newdata = NULL;
-        if(newsize > 0) newdata = (char*)malloc(newsize);
+        if(m_data && m_ownsdata)
+        {
+            newdata = (char*)realloc(m_data, newsize); // the old memory is still valid if it fails
+            if(newdata) m_data = NULL;
+        }
+        else if(newsize > 0) newdata = (char*)malloc(newsize);
 
         if(newdata)
         {
             if(newdata && m_data) memcpy(newdata, m_data, m_size);
 
-            if(m_data) free(m_data);
+            if(m_data && m_ownsdata) free(m_data);
+
+            // it has its own memory now
+            m_source.reset();
+            m_offset = 0;
 
             m_data = newdata;
+            m_ownsdata = true;
 
             m_size = value;
             m_max = newsize;
@@ -304,6 +466,21 @@ void IoBuffer::session(SessionPtr value)
     m_session = value;
 }
 
+bool IoBuffer::IsSlice() const
+{
+    return m_source ? true : false;
+}
+
+boost::shared_ptr<IoBuffer> IoBuffer::GetSource() const
+{
+    return m_source;
+}
+
+int IoBuffer::GetOffset() const
+{
+    return m_offset;
+}
+
 int IoBuffer::GetReadPos()
 {
     return m_readpos;
@@ -483,6 +660,42 @@ void IoBuffer::PutStr(const std::string& value)
     }
 }
 
+esnlib::IoBufferPtr esnlib::CreateIoBufferSlice(esnlib::IoBufferPtr source, int offset, int len)
+{
+    esnlib::IoBufferPtr slice = boost::make_shared<esnlib::IoBuffer>(source, offset, len);
+    return slice;
+}
 
+esnlib::IoBufferPtr esnlib::CreateIoBuffer(int size)
+{
+    esnlib::IoBufferPtr buf;
 
+    if(size < 0) size = 0;
+    if(size > ESN_MAX_IOBUF_SIZE) size = ESN_MAX_IOBUF_SIZE;
 
+    try
+    {
+        if(size <= ESN_IOBUF_INLINE_SIZE)
+        {
+            buf = boost::make_shared<esnlib::IoBuffer>(size); // the data will be inline
+        }
+        else
+        {
+            char* data = NULL;
+            buf = boost::allocate_shared<esnlib::IoBuffer>(IoBufferBlockAllocator<esnlib::IoBuffer>(size, &data), 0);
+            if(buf && data)
+            {
+                buf->m_data = data;
+                buf->m_ownsdata = false;
+                buf->m_size = size;
+                buf->m_max = size;
+            }
+        }
+    }
+    catch(std::bad_alloc&)
+    {
+        buf.reset();
+    }
+
+    return buf;
+}
@@ -45,12 +45,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define ESN_DEFAULT_IOBUF_SIZE 2048
 #endif
 
+#ifndef ESN_IOBUF_INLINE_SIZE
+#define ESN_IOBUF_INLINE_SIZE 64
+#endif
+
 namespace esnlib
 {
 
 /// IO Buffer class
+///
+/// Small data (no more than ESN_IOBUF_INLINE_SIZE bytes) will be kept in the object itself without another allocation.
 class IoBuffer : public Buffer
 {
+    friend boost::shared_ptr<IoBuffer> CreateIoBuffer(int size);
+
 public:
 
     /// Constructor function
@@ -65,13 +73,25 @@ public:
     /// Constructor function
     ///
     /// @param size The buffer size
-    explicit IoBuffer(int size);
+    /// @param exactcapacity Whether the capacity should be the size itself (or rounded up to a multiple of ESN_DEFAULT_IOBUF_SIZE)
+    explicit IoBuffer(int size, bool exactcapacity = false);
 
     /// Constructor function
     ///
     /// @param src The other buffer whose content will be copied
     explicit IoBuffer(const IoBuffer& src);
 
+    /// Constructor function, the new buffer will be a slice of the source buffer (no copy)
+    ///
+    /// A slice shares the ownership of the source buffer's memory, and has its own read/write positions.
+    /// The source buffer must not be resized while the slice is still alive.
+    /// And if the slice is resized beyond its length, it will get its own memory (a copy) and stop being a slice.
+    ///
+    /// @param source The source buffer
+    /// @param offset Where the shared part begins in the source buffer
+    /// @param len The length of the shared part
+    IoBuffer(boost::shared_ptr<IoBuffer> source, int offset, int len);
+
     /// Destructor function
     virtual ~IoBuffer();
 
@@ -92,10 +112,22 @@ public:
 
     /// Set the buffer size
     ///
+    /// The capacity will be doubled at least when the buffer has to grow its own memory.
+    ///
     /// @param value The new buffer size we ask for
     /// @return The actual buffer size got finally
     int size(int value);
 
+    /// Get the size of the data held by the buffer (same as size())
+    ///
+    /// @return The data size in bytes
+    virtual int datasize() const;
+
+    /// Get the buffer capacity
+    ///
+    /// @return How many bytes the buffer can hold without reallocating its memory
+    int capacity() const;
+
     /// Get the buffer flag
     ///
     /// @return The buffer flag
@@ -151,6 +183,21 @@ public:
     /// @param value The pointer of the session
     void session(SessionPtr value);
 
+    /// Check whether the buffer is a slice (sharing a part of another buffer's memory)
+    ///
+    /// @return Return true if the buffer is a slice
+    bool IsSlice() const;
+
+    /// Get the buffer which owns the memory of the slice
+    ///
+    /// @return The pointer of the source buffer (empty if the buffer is not a slice)
+    boost::shared_ptr<IoBuffer> GetSource() const;
+
+    /// Get the position where the slice begins in its source buffer
+    ///
+    /// @return The offset in the source buffer (0 if the buffer is not a slice)
+    int GetOffset() const;
+
     /// Get the read position
     ///
     /// @return The read position
@@ -240,6 +287,13 @@ protected:
 private:
     char* m_data;
 
+    boost::shared_ptr<IoBuffer> m_source; // who owns the memory if the buffer is sharing another buffer's memory
+    int m_offset;
+
+    bool m_ownsdata; // whether m_data is allocated (and should be freed) by the buffer itself
+
+    char m_inline[ESN_IOBUF_INLINE_SIZE]; // the memory for small data
+
     int m_size;
     int m_max;
 
@@ -259,6 +313,23 @@ private:
 
 typedef boost::shared_ptr<IoBuffer> IoBufferPtr;
 
+/// Create an IO buffer with only one allocation (the object, the reference count and the memory of the data)
+///
+/// The memory allocated together has the exact size (no rounding up),
+/// if the buffer grows beyond it later, the buffer will get another memory of its own.
+///
+/// @param size The buffer size
+/// @return The pointer of the buffer
+IoBufferPtr CreateIoBuffer(int size);
+
+/// Create a slice of the IO buffer (no copy)
+///
+/// @param source The source buffer (can be a slice too)
+/// @param offset Where the slice begins in the source buffer
+/// @param len The length of the slice (the rest of the source buffer if it is negative)
+/// @return The pointer of the slice
+IoBufferPtr CreateIoBufferSlice(IoBufferPtr source, int offset, int len = -1);
+
 typedef std::deque<IoBufferPtr> IoBufferQueue;
 
 }
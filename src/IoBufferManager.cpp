@@ -29,10 +29,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 -----------------------------------------------------------------------------
 */
 
-#include <list>
+#include <ctime>
+#include <map>
+#include <deque>
+#include <vector>
 #include <sstream>
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/weak_ptr.hpp>
 
 #include "LogManager.h"
 
@@ -50,6 +59,296 @@ IoBufferManager::~IoBufferManager()
     //dtor
 }
 
+/// A free buffer kept by the shared pool
+class IoBufferItem
+{
+public:
+    IoBufferItem(IoBufferPtr buf, time_t freetime): m_buf(buf), m_freetime(freetime) {}
+
+    IoBufferPtr m_buf;
+    time_t m_freetime; // since when the buffer has been free
+};
+
+/// One size class of the pool, all free buffers in it can hold the class size at least
+class IoBufferClass
+{
+public:
+    IoBufferClass(int bufsize, int magazinesize): m_bufsize(bufsize), m_magazinesize(magazinesize) {}
+
+    int m_bufsize;
+    int m_magazinesize; // how many free buffers of the class a thread can keep in its own cache
+
+    std::deque<IoBufferItem> m_items; // the oldest free buffer is at the front
+    boost::mutex m_mutex;
+};
+
+/// The shared part of the pool (all size classes), it will stay alive until the last thread cache has gone
+class IoBufferDepot
+{
+public:
+    IoBufferDepot();
+    ~IoBufferDepot();
+
+    // the smallest class which can hold the size (-1 if it is too large for any class)
+    int GetClassIndex(int bufsize);
+
+    // the largest class which a buffer with the capacity can serve (-1 if there is not a suitable one)
+    int GetClassIndexByCapacity(int capacity);
+
+    // move free buffers from the class into the magazine (with one lock)
+    void Refill(int index, std::vector<IoBufferPtr>& magazine, int count);
+
+    // move free buffers from the magazine into the class (with one lock)
+    void Flush(int index, std::vector<IoBufferPtr>& magazine, int count);
+
+    // release the free buffers idle for some time
+    long long Trim(int idleseconds);
+
+    std::vector<IoBufferClass*> m_classes;
+
+    boost::atomic<long long> m_hits;
+    boost::atomic<long long> m_misses;
+    boost::atomic<long long> m_totalbytes;
+    boost::atomic<long long> m_freebytes;
+    boost::atomic<long long> m_peakbytes;
+
+    boost::atomic<bool> m_closed; // the buffer manager has gone, the thread caches should let it go too
+};
+
+typedef boost::shared_ptr<IoBufferDepot> IoBufferDepotPtr;
+
+/// The deleter of the buffers allocated by the pool, it keeps the statistics right when a buffer is released
+class IoBufferDeleter
+{
+public:
+    IoBufferDeleter(IoBufferDepotPtr depot, long long bytes): m_depot(depot), m_bytes(bytes) {}
+
+    void operator()(IoBuffer* buf)
+    {
+        IoBufferDepotPtr depot = m_depot.lock();
+        if(depot) depot->m_totalbytes -= m_bytes;
+        delete buf;
+    }
+
+    boost::weak_ptr<IoBufferDepot> m_depot;
+    long long m_bytes; // how many bytes of the buffer have been counted
+};
+
+/// The free buffers cached by one thread, so most of the requests will not need any lock
+class IoBufferCache
+{
+public:
+    explicit IoBufferCache(IoBufferDepotPtr depot);
+    ~IoBufferCache();
+
+    IoBufferDepotPtr m_depot;
+    std::vector< std::vector<IoBufferPtr> > m_magazines; // one magazine for each size class
+};
+
+/// All the caches of one thread (one for each buffer manager used by the thread)
+class IoBufferCacheSet
+{
+public:
+    IoBufferCacheSet(): m_lastid(0), m_lastcache(NULL) {}
+    ~IoBufferCacheSet();
+
+    // get the cache of the buffer manager (by its id, which is never reused), create it if there is not one
+    IoBufferCache* GetCache(long long id, IoBufferDepotPtr depot);
+
+    // release the caches of the buffer managers which have gone
+    void Purge();
+
+    long long m_lastid;
+    IoBufferCache* m_lastcache;
+
+    std::map<long long, IoBufferCache*> m_caches;
+};
+
+static boost::thread_specific_ptr<IoBufferCacheSet> thread_caches;
+
+static boost::atomic<long long> next_manager_id(1);
+
+IoBufferDepot::IoBufferDepot()
+: m_hits(0)
+, m_misses(0)
+, m_totalbytes(0)
+, m_freebytes(0)
+, m_peakbytes(0)
+, m_closed(false)
+{
+    int classsize = ESN_IOBUF_MIN_CLASS_SIZE;
+    if(classsize <= 0) classsize = ESN_DEFAULT_IOBUF_SIZE;
+
+    while(classsize <= ESN_IOBUF_MAX_CLASS_SIZE)
+    {
+        int magazinesize = ESN_IOBUF_MAGAZINE_BYTES / classsize;
+        if(magazinesize > ESN_IOBUF_MAGAZINE_SIZE) magazinesize = ESN_IOBUF_MAGAZINE_SIZE;
+        if(magazinesize < 1) magazinesize = 1;
+
+        m_classes.push_back(new IoBufferClass(classsize, magazinesize));
+        if(classsize > ESN_IOBUF_MAX_CLASS_SIZE / 2) break;
+        classsize = classsize * 2;
+    }
+}
+
+IoBufferDepot::~IoBufferDepot()
+{
+    for(size_t i=0; i<m_classes.size(); i++) delete m_classes[i];
+    m_classes.clear();
+}
+
+int IoBufferDepot::GetClassIndex(int bufsize)
+{
+    int count = m_classes.size();
+    for(int i=0; i<count; i++)
+    {
+        if(m_classes[i]->m_bufsize >= bufsize) return i;
+    }
+    return -1;
+}
+
+int IoBufferDepot::GetClassIndexByCapacity(int capacity)
+{
+    int index = -1;
+    int count = m_classes.size();
+    for(int i=0; i<count; i++)
+    {
+        if(m_classes[i]->m_bufsize <= capacity) index = i;
+        else break;
+    }
+
+    // a buffer which has grown too large should not stay in the pool
+    if(index >= 0 && index == count - 1 && capacity > m_classes[index]->m_bufsize * 2) index = -1;
+
+    return index;
+}
+
+void IoBufferDepot::Refill(int index, std::vector<IoBufferPtr>& magazine, int count)
+{
+    IoBufferClass* bufclass = m_classes[index];
+    boost::unique_lock<boost::mutex> lock(bufclass->m_mutex);
+    while(count > 0 && bufclass->m_items.size() > 0)
+    {
+        magazine.push_back(bufclass->m_items.back().m_buf);
+        bufclass->m_items.pop_back();
+        count--;
+    }
+}
+
+void IoBufferDepot::Flush(int index, std::vector<IoBufferPtr>& magazine, int count)
+{
+    time_t now = time(NULL);
+    IoBufferClass* bufclass = m_classes[index];
+    boost::unique_lock<boost::mutex> lock(bufclass->m_mutex);
+    while(count > 0 && magazine.size() > 0)
+    {
+        bufclass->m_items.push_back(IoBufferItem(magazine.back(), now));
+        magazine.pop_back();
+        count--;
+    }
+}
+
+long long IoBufferDepot::Trim(int idleseconds)
+{
+    long long total = 0;
+
+    time_t now = time(NULL);
+
+    for(size_t i=0; i<m_classes.size(); i++)
+    {
+        std::vector<IoBufferPtr> trashlist; // release them out of the lock
+
+        IoBufferClass* bufclass = m_classes[i];
+        if(bufclass->m_items.empty()) continue;
+
+        {
+            boost::unique_lock<boost::mutex> lock(bufclass->m_mutex);
+            while(bufclass->m_items.size() > 0 && now - bufclass->m_items.front().m_freetime >= idleseconds)
+            {
+                trashlist.push_back(bufclass->m_items.front().m_buf);
+                bufclass->m_items.pop_front();
+            }
+        }
+
+        for(size_t j=0; j<trashlist.size(); j++)
+        {
+            m_freebytes -= trashlist[j]->capacity();
+            total += trashlist[j]->capacity();
+        }
+    }
+
+    return total;
+}
+
+IoBufferCache::IoBufferCache(IoBufferDepotPtr depot)
+: m_depot(depot)
+, m_magazines(depot->m_classes.size())
+{
+}
+
+IoBufferCache::~IoBufferCache()
+{
+    // give all cached buffers back to the shared pool when the thread exits
+    // (if the buffer manager has gone, they will just be released)
+    if(m_depot->m_closed) return;
+
+    for(size_t i=0; i<m_magazines.size(); i++)
+    {
+        if(m_magazines[i].size() > 0) m_depot->Flush(i, m_magazines[i], m_magazines[i].size());
+    }
+}
+
+IoBufferCacheSet::~IoBufferCacheSet()
+{
+    std::map<long long, IoBufferCache*>::iterator it = m_caches.begin();
+    while(it != m_caches.end())
+    {
+        delete it->second;
+        it++;
+    }
+    m_caches.clear();
+}
+
+IoBufferCache* IoBufferCacheSet::GetCache(long long id, IoBufferDepotPtr depot)
+{
+    if(id == m_lastid) return m_lastcache;
+
+    IoBufferCache* cache = NULL;
+
+    std::map<long long, IoBufferCache*>::iterator it = m_caches.find(id);
+    if(it != m_caches.end()) cache = it->second;
+    else
+    {
+        Purge(); // a good time to check the old ones
+        cache = new IoBufferCache(depot);
+        m_caches.insert(std::map<long long, IoBufferCache*>::value_type(id, cache));
+    }
+
+    m_lastid = id;
+    m_lastcache = cache;
+
+    return cache;
+}
+
+void IoBufferCacheSet::Purge()
+{
+    std::map<long long, IoBufferCache*>::iterator it = m_caches.begin();
+    while(it != m_caches.end())
+    {
+        if(it->second->m_depot->m_closed)
+        {
+            if(it->second == m_lastcache)
+            {
+                m_lastid = 0;
+                m_lastcache = NULL;
+            }
+            delete it->second;
+            m_caches.erase(it++);
+        }
+        else it++;
+    }
+}
+
 class IoBufferManagerImpl : public IoBufferManager
 {
 public:
@@ -63,70 +362,202 @@ public:
     virtual IoBufferPtr GetFreeBuffer(int bufsize);
     virtual void TakeBack(IoBufferPtr buf);
 
+    virtual int Preallocate(int bufsize, int itemcount);
+
+    virtual long long GetMemoryLimit(int limittype);
+    virtual void SetMemoryLimit(int limittype, long long value);
+
+    virtual int GetIdleTimeout();
+    virtual void SetIdleTimeout(int seconds);
+
+    virtual long long Trim(int idleseconds);
+
+    virtual long long GetStatistics(int stattype);
+
 protected:
 private:
 
-    std::list<IoBufferPtr> m_items;
-    boost::mutex m_mutex;
+    IoBufferCache* GetThreadCache();
+
+    // allocate a new buffer with the deleter which keeps the statistics right (it will check the budget too)
+    IoBufferPtr NewBuffer(int bufsize);
+
+    void TrimIdleBuffers();
+
+    IoBufferDepotPtr m_depot;
+    long long m_id; // the key of its caches in every thread
 
     int m_bufsize;
 
+    boost::atomic<long long> m_budget;
+    boost::atomic<long long> m_watermark;
+
+    int m_idletimeout;
+
+    bool m_stopping;
+    boost::thread* m_trimthread;
+    boost::mutex m_trimmutex;
+    boost::condition_variable m_trimcondition;
+
 };
 
 IoBufferManagerImpl::IoBufferManagerImpl()
+: m_depot(new IoBufferDepot())
+, m_id(next_manager_id++)
 {
     //ctor
     m_bufsize = ESN_DEFAULT_IOBUF_SIZE;
+
+    m_budget = 0;
+    m_watermark = 0;
+    m_idletimeout = 0;
+
+    m_stopping = false;
+    m_trimthread = NULL;
 }
 
 IoBufferManagerImpl::IoBufferManagerImpl(int itemcount, int bufsize)
+: m_depot(new IoBufferDepot())
+, m_id(next_manager_id++)
 {
     m_bufsize = bufsize;
     if(m_bufsize <= 0) m_bufsize = ESN_DEFAULT_IOBUF_SIZE;
 
-    for(int i=0; i<itemcount; i++)
+    m_budget = 0;
+    m_watermark = 0;
+    m_idletimeout = 0;
+
+    m_stopping = false;
+    m_trimthread = NULL;
+
+    Preallocate(m_bufsize, itemcount);
+}
+
+IoBufferManagerImpl::~IoBufferManagerImpl()
+{
+    if(m_trimthread)
     {
-        IoBufferPtr task(new IoBuffer(m_bufsize));
-        m_items.push_back(task);
+        {
+            boost::unique_lock<boost::mutex> lock(m_trimmutex);
+            m_stopping = true;
+            m_trimcondition.notify_all();
+        }
+        m_trimthread->join();
+        delete m_trimthread;
+        m_trimthread = NULL;
     }
+
+    // the caches of other threads will be released when those threads use a new buffer manager, or exit
+    m_depot->m_closed = true;
+
+    IoBufferCacheSet* caches = thread_caches.get();
+    if(caches) caches->Purge();
 }
 
-IoBufferManagerImpl::~IoBufferManagerImpl()
+IoBufferCache* IoBufferManagerImpl::GetThreadCache()
+{
+    IoBufferCacheSet* caches = thread_caches.get();
+    if(!caches)
+    {
+        caches = new IoBufferCacheSet();
+        thread_caches.reset(caches);
+    }
+    return caches->GetCache(m_id, m_depot);
+}
+
+IoBufferPtr IoBufferManagerImpl::NewBuffer(int bufsize)
 {
-    m_items.clear();
+    IoBufferPtr buf;
+
+    if(m_budget > 0 && m_depot->m_totalbytes + bufsize > m_budget)
+    {
+        // the free buffers kept in the magazines of current thread are counted too,
+        // so give them back to the shared pool first, then release all free buffers there
+        IoBufferCache* cache = GetThreadCache();
+        for(size_t i=0; i<cache->m_magazines.size(); i++)
+        {
+            if(cache->m_magazines[i].size() > 0) m_depot->Flush(i, cache->m_magazines[i], cache->m_magazines[i].size());
+        }
+        Trim(0);
+        if(m_depot->m_totalbytes + bufsize > m_budget)
+        {
+            std::stringstream ss;
+            ss << "The memory budget of the buffer pool is used up (" << m_budget << " bytes)";
+            LogManager::Warning(ss.str());
+            return buf;
+        }
+    }
+
+    // the capacity must be the class size itself, or it will be taken back into another class
+    IoBuffer* newbuf = new IoBuffer(bufsize, true);
+    buf.reset(newbuf, IoBufferDeleter(m_depot, newbuf->capacity()));
+    m_depot->m_totalbytes += newbuf->capacity();
+
+    int index = m_depot->GetClassIndex(bufsize);
+    if(index >= 0 && m_depot->m_classes[index]->m_bufsize == bufsize && m_depot->GetClassIndexByCapacity(newbuf->capacity()) != index)
+    {
+        std::stringstream ss;
+        ss << "The new buffer of size class " << bufsize << " has a different capacity (" << newbuf->capacity() << " bytes)";
+        LogManager::Warning(ss.str());
+    }
+
+    return buf;
 }
 
 IoBufferPtr IoBufferManagerImpl::GetFreeBuffer(int bufsize)
 {
     IoBufferPtr buf;
-    if(!buf)
+
+    if(bufsize < 0) bufsize = 0;
+
+    int index = m_depot->GetClassIndex(bufsize);
+    if(index >= 0)
     {
-        boost::unique_lock<boost::mutex> lock(m_mutex);
-        if(m_items.size() > 0)
+        IoBufferClass* bufclass = m_depot->m_classes[index];
+        std::vector<IoBufferPtr>& magazine = GetThreadCache()->m_magazines[index];
+
+        // refill half of the magazine from the shared pool in one go
+        if(magazine.size() == 0) m_depot->Refill(index, magazine, (bufclass->m_magazinesize + 1) / 2);
+
+        if(magazine.size() > 0)
         {
-            IoBufferPtr item = m_items.front();
-            if(item)
-            {
-                item->size(bufsize);
-                item->SetReadPos(0);
-                item->SetWritePos(0);
-                item->recyclable(true);
-                //printf("Found IoTask: %d\n", (int)(item.get()));
-            }
-            if(item && item->size() >= bufsize)
-            {
-                buf = item;
-                m_items.pop_front();
-            }
+            buf = magazine.back();
+            magazine.pop_back();
+            m_depot->m_freebytes -= buf->capacity();
+            m_depot->m_hits++;
         }
-        else
+
+        if(!buf)
         {
-            IoBufferPtr newbuf(new IoBuffer(bufsize));
-            newbuf->recyclable(true);
+            buf = NewBuffer(bufclass->m_bufsize);
+            m_depot->m_misses++;
+        }
 
-            if(newbuf && newbuf->size() >= bufsize) buf = newbuf;
+        if(buf)
+        {
+            buf->size(bufsize);
+            buf->SetReadPos(0);
+            buf->SetWritePos(0);
+            buf->recyclable(true);
+            //printf("Found IoTask: %d\n", (int)(buf.get()));
         }
     }
+    else
+    {
+        // too large for the pool, just go to the allocator (and it will not be recycled)
+        buf = NewBuffer(bufsize);
+        m_depot->m_misses++;
+        if(buf) buf->recyclable(false);
+    }
+
+    if(buf && buf->size() < bufsize) buf.reset();
+
+    if(buf)
+    {
+        long long outstanding = m_depot->m_totalbytes - m_depot->m_freebytes;
+        long long peak = m_depot->m_peakbytes;
+        while(outstanding > peak && !m_depot->m_peakbytes.compare_exchange_weak(peak, outstanding)) {}
+    }
 
     //if(!buf) std::cout << "Fail to get free buffer with size " << bufsize << std::endl;
     if(!buf)
@@ -141,12 +572,148 @@ IoBufferPtr IoBufferManagerImpl::GetFreeBuffer(int bufsize)
 void IoBufferManagerImpl::TakeBack(IoBufferPtr buf)
 {
     IoBufferPtr item = buf;
-    if(item)
+    if(item && !item->IsSlice()) // a slice does not own its memory, so it should not be kept in the pool
     {
-        boost::unique_lock<boost::mutex> lock(m_mutex);
+        int capacity = item->capacity();
+
+        // only the buffers created by this pool are counted in its stats, so the others should not be kept
+        IoBufferDeleter* deleter = boost::get_deleter<IoBufferDeleter>(item);
+        if(!deleter || deleter->m_depot.owner_before(m_depot) || m_depot.owner_before(deleter->m_depot))
+        {
+            item->recyclable(false);
+            return;
+        }
+
+        // the buffer may have grown while it was in use
+        if(deleter->m_bytes != capacity)
+        {
+            m_depot->m_totalbytes += capacity - deleter->m_bytes;
+            deleter->m_bytes = capacity;
+        }
+
+        int index = m_depot->GetClassIndexByCapacity(capacity);
+        if(index < 0 || (m_watermark > 0 && m_depot->m_freebytes + capacity > m_watermark))
+        {
+            item->recyclable(false); // let it go
+            return;
+        }
+
         item->recyclable(true);
-        m_items.push_back(item);
+
+        IoBufferClass* bufclass = m_depot->m_classes[index];
+        std::vector<IoBufferPtr>& magazine = GetThreadCache()->m_magazines[index];
+
+        magazine.push_back(item);
+        m_depot->m_freebytes += capacity;
         //printf("Take back IoTask: %d\n", (int)(task.get()));
+
+        // return half of the magazine to the shared pool in one go when it is full
+        if((int)magazine.size() > bufclass->m_magazinesize) m_depot->Flush(index, magazine, (bufclass->m_magazinesize + 1) / 2);
+    }
+}
+
+int IoBufferManagerImpl::Preallocate(int bufsize, int itemcount)
+{
+    if(bufsize < 0) bufsize = 0;
+
+    int index = m_depot->GetClassIndex(bufsize);
+    if(index < 0) return 0;
+
+    IoBufferClass* bufclass = m_depot->m_classes[index];
+
+    int count = 0;
+    if(count == 0)
+    {
+        boost::unique_lock<boost::mutex> lock(bufclass->m_mutex);
+        count = itemcount - bufclass->m_items.size();
+    }
+
+    // allocate them out of the lock (the budget check may need to trim the pool)
+    std::vector<IoBufferPtr> newlist;
+    for(int i=0; i<count; i++)
+    {
+        if(m_watermark > 0 && m_depot->m_freebytes + bufclass->m_bufsize > m_watermark) break;
+
+        IoBufferPtr item = NewBuffer(bufclass->m_bufsize);
+        if(!item || item->capacity() < bufclass->m_bufsize) break;
+        item->recyclable(true);
+        newlist.push_back(item);
+        m_depot->m_freebytes += item->capacity();
+    }
+
+    time_t now = time(NULL);
+
+    boost::unique_lock<boost::mutex> lock(bufclass->m_mutex);
+    for(size_t i=0; i<newlist.size(); i++) bufclass->m_items.push_back(IoBufferItem(newlist[i], now));
+
+    return bufclass->m_items.size();
+}
+
+long long IoBufferManagerImpl::GetMemoryLimit(int limittype)
+{
+    if(limittype == 1) return m_budget;
+    else if(limittype == 2) return m_watermark;
+    else return 0;
+}
+
+void IoBufferManagerImpl::SetMemoryLimit(int limittype, long long value)
+{
+    if(value < 0) value = 0;
+    if(limittype == 1) m_budget = value;
+    else if(limittype == 2) m_watermark = value;
+}
+
+int IoBufferManagerImpl::GetIdleTimeout()
+{
+    return m_idletimeout;
+}
+
+void IoBufferManagerImpl::SetIdleTimeout(int seconds)
+{
+    boost::unique_lock<boost::mutex> lock(m_trimmutex);
+
+    m_idletimeout = seconds > 0 ? seconds : 0;
+
+    if(m_idletimeout > 0 && !m_trimthread && !m_stopping)
+    {
+        m_trimthread = new boost::thread(boost::bind(&IoBufferManagerImpl::TrimIdleBuffers, this));
+    }
+}
+
+void IoBufferManagerImpl::TrimIdleBuffers()
+{
+    boost::unique_lock<boost::mutex> lock(m_trimmutex);
+    while(!m_stopping)
+    {
+        m_trimcondition.timed_wait(lock, boost::posix_time::milliseconds(ESN_IOBUF_TRIM_INTERVAL));
+        if(m_stopping) break;
+
+        int idletimeout = m_idletimeout;
+        if(idletimeout <= 0) continue;
+
+        lock.unlock();
+        Trim(idletimeout);
+        lock.lock();
+    }
+}
+
+long long IoBufferManagerImpl::Trim(int idleseconds)
+{
+    if(idleseconds < 0) idleseconds = 0;
+    return m_depot->Trim(idleseconds);
+}
+
+long long IoBufferManagerImpl::GetStatistics(int stattype)
+{
+    switch(stattype)
+    {
+    case STAT_HITS: return m_depot->m_hits;
+    case STAT_MISSES: return m_depot->m_misses;
+    case STAT_TOTAL_BYTES: return m_depot->m_totalbytes;
+    case STAT_FREE_BYTES: return m_depot->m_freebytes;
+    case STAT_OUTSTANDING_BYTES: return m_depot->m_totalbytes - m_depot->m_freebytes;
+    case STAT_PEAK_OUTSTANDING_BYTES: return m_depot->m_peakbytes;
+    default: return 0;
     }
 }
 
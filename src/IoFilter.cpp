@@ -36,6 +36,7 @@ using namespace esnlib;
 IoFilter::IoFilter()
 {
     //ctor
+    m_stateslot = 0;
 }
 
 IoFilter::~IoFilter()
@@ -43,3 +44,32 @@ IoFilter::~IoFilter()
     //dtor
 }
 
+IoBufferPtr IoFilter::EncodeAndFinish(SessionPtr session, void* data)
+{
+    IoBufferPtr buf = Encode(session, data);
+    if(buf) buf = FinishEncoding(session, buf);
+    return buf;
+}
+
+IoBufferPtr IoFilter::FinishEncoding(SessionPtr session, IoBufferPtr data)
+{
+    return data;
+}
+
+int IoFilter::AssignStateSlots(int first)
+{
+    m_stateslot = first;
+    return first + 1;
+}
+
+BusinessPtr IoFilter::GetSessionState(SessionPtr session)
+{
+    BusinessPtr state;
+    if(session) state = session->GetFilterState(m_stateslot);
+    return state;
+}
+
+void IoFilter::SetSessionState(SessionPtr session, BusinessPtr state)
+{
+    if(session) session->SetFilterState(m_stateslot, state);
+}
@@ -0,0 +1,218 @@
+/*
+-----------------------------------------------------------------------------
+This source file is part of "esnetwork" library.
+It is licensed under the terms of the BSD license.
+For the latest info, see http://esnetwork.sourceforge.net
+
+Copyright (c) 2012-2013 Lin Jia Jun (Joe Lam)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------------
+*/
+
+#include <cstring>
+
+#include "IoHandler.h"
+
+#include "LogManager.h"
+
+#include "IoFilterChain.h"
+
+using namespace esnlib;
+
+namespace
+{
+
+/// The state of the chain kept in the session
+class IoFilterChainState : public Business
+{
+public:
+
+    /// The bytes left unconsumed by every filter (for next round)
+    std::vector<IoBufferPtr> m_pending;
+
+};
+
+void report_read_error(SessionPtr session, const std::string& errmsg)
+{
+    IoHandlerPtr handler;
+    if(session) handler = session->GetIoHandler();
+    if(handler)
+    {
+        try { handler->OnError(session, 1, 0, errmsg); }
+        catch(...) { LogManager::Warning( "Exception found in OnError() event." ); }
+    }
+    else LogManager::Warning(errmsg);
+}
+
+}
+
+IoFilterChain::IoFilterChain()
+{
+    //ctor
+    m_firstslot = 0;
+}
+
+IoFilterChain::~IoFilterChain()
+{
+    //dtor
+}
+
+int IoFilterChain::AddFilter(IoFilterPtr filter)
+{
+    if(filter)
+    {
+        m_filters.push_back(filter);
+        AssignStateSlots(m_firstslot); // give the new one its own slot
+    }
+    return m_filters.size();
+}
+
+int IoFilterChain::AssignStateSlots(int first)
+{
+    m_firstslot = first;
+    int next = IoFilter::AssignStateSlots(first);
+    for(size_t i=0; i<m_filters.size(); i++) next = m_filters[i]->AssignStateSlots(next);
+    return next;
+}
+
+int IoFilterChain::GetFilterCount()
+{
+    return m_filters.size();
+}
+
+IoFilterPtr IoFilterChain::GetFilter(int index)
+{
+    IoFilterPtr filter;
+    if(index >= 0 && index < (int)m_filters.size()) filter = m_filters[index];
+    return filter;
+}
+
+bool IoFilterChain::Extract(SessionPtr session, IoBufferPtr data, std::vector<IoBufferPtr>& readylist)
+{
+    int count = m_filters.size();
+
+    // no filter, work like a session without filter
+    if(count <= 0)
+    {
+        readylist.push_back(data);
+        return true;
+    }
+
+    if(count == 1) return m_filters[0]->Extract(session, data, readylist);
+
+    std::vector<IoBufferPtr> current;
+    std::vector<IoBufferPtr> next;
+
+    bool reset = m_filters[0]->Extract(session, data, current);
+    if(current.empty()) return reset;
+
+    boost::shared_ptr<IoFilterChainState> state;
+    BusinessPtr existing = GetSessionState(session);
+    if(existing) state = boost::static_pointer_cast<IoFilterChainState>(existing);
+
+    for(int i=1; i<count; i++)
+    {
+        std::vector<IoBufferPtr>& output = i == count - 1 ? readylist : next;
+
+        int total = current.size();
+        for(int j=0; j<total; j++)
+        {
+            IoBufferPtr input = current[j];
+
+            // join the bytes left by last round (only the pieces of a split message will be copied)
+            if(state && state->m_pending[i])
+            {
+                IoBufferPtr pending = state->m_pending[i];
+                IoBufferPtr joined = CreateIoBuffer(pending->size() + input->size());
+                state->m_pending[i].reset();
+                if(!joined || joined->size() < pending->size() + input->size())
+                {
+                    // the split data can not be put together again, so both parts are lost
+                    report_read_error(session, "Failed to get buffer for joining incoming data");
+                    continue;
+                }
+                memcpy(joined->data(), pending->data(), pending->size());
+                memcpy(joined->data() + pending->size(), input->data(), input->size());
+                input = joined;
+            }
+
+            bool done = m_filters[i]->Extract(session, input, output);
+
+            int leftsize = input->size() - input->GetReadPos();
+            if(!done && leftsize > 0)
+            {
+                if(!state)
+                {
+                    if(!session) continue;
+                    state = boost::shared_ptr<IoFilterChainState>(new IoFilterChainState());
+                    state->m_pending.resize(count);
+                    SetSessionState(session, state);
+                }
+
+                // copy the rest so it will not hold the whole receive block
+                IoBufferPtr rest = CreateIoBuffer(leftsize);
+                if(rest && rest->size() == leftsize)
+                {
+                    memcpy(rest->data(), input->data() + input->GetReadPos(), leftsize);
+                    state->m_pending[i] = rest;
+                }
+                else report_read_error(session, "Failed to get buffer for keeping incoming data");
+            }
+        }
+
+        if(i < count - 1)
+        {
+            current.swap(next);
+            next.clear();
+            if(current.empty()) break;
+        }
+    }
+
+    return reset;
+}
+
+IoBufferPtr IoFilterChain::Encode(SessionPtr session, void* data)
+{
+    IoBufferPtr current;
+
+    int count = m_filters.size();
+    if(count <= 0) return current;
+
+    current = m_filters[count - 1]->EncodeAndFinish(session, data);
+
+    for(int i=count-2; i>=0 && current; i--)
+    {
+        // pass a slice, so the filter can return a new slice of the same memory if it has nothing to do
+        if(!current->IsSlice()) current = CreateIoBufferSlice(current, 0, current->size());
+        current = m_filters[i]->EncodeAndFinish(session, (void*)(current.get()));
+    }
+
+    return current;
+}
+
+void* IoFilterChain::Decode(SessionPtr session, IoBufferPtr data)
+{
+    int count = m_filters.size();
+    if(count <= 0) return NULL;
+    return m_filters[count - 1]->Decode(session, data);
+}
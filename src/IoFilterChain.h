@@ -0,0 +1,122 @@
+/*
+-----------------------------------------------------------------------------
+This source file is part of "esnetwork" library.
+It is licensed under the terms of the BSD license.
+For the latest info, see http://esnetwork.sourceforge.net
+
+Copyright (c) 2012-2013 Lin Jia Jun (Joe Lam)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _ESN_IOFILTERCHAIN_H_
+#define _ESN_IOFILTERCHAIN_H_
+
+#include "IoFilter.h"
+
+namespace esnlib
+{
+
+/// IO Filter Chain class, a filter made up of ordered filters (stages)
+///
+/// The first filter added is the nearest one to the network and the last one is the nearest one to the handler.
+/// When reading, the first filter extracts data from the incoming bytes, and then every piece of the data
+/// will be passed to the next filter to be extracted again, until the last filter.
+/// When writing, the last filter encodes the raw buffer, and then the IO buffer will be passed to the previous filter
+/// (as the raw buffer) to be encoded again, until the first filter.
+/// Only the last filter decodes the IO buffer.
+///
+/// The buffers are passed between the filters without copying. When writing, a filter (not the last one) always gets
+/// a slice (see IoBuffer::IsSlice()), so it can return a new slice of the same memory if it has nothing to do.
+/// If a filter (not the first one) leaves some bytes unconsumed, they will be kept in the session for next round.
+class IoFilterChain : public IoFilter
+{
+public:
+
+    /// Constructor function
+    IoFilterChain();
+
+    /// Destructor function
+    virtual ~IoFilterChain();
+
+    /// Add a filter to the end of the chain (the handler side)
+    ///
+    /// Please add all the filters before the chain is used by any session.
+    ///
+    /// @param filter The pointer of the filter
+    /// @return Total number of the filters in the chain
+    int AddFilter(IoFilterPtr filter);
+
+    /// Get total number of the filters
+    ///
+    /// @return Total number of the filters in the chain
+    int GetFilterCount();
+
+    /// Get a filter
+    ///
+    /// @param index The index of the filter (0 is the first one, the network side)
+    /// @return The pointer of the filter
+    IoFilterPtr GetFilter(int index);
+
+    /// Extract useful data from the incoming bytes (with all the filters in order)
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the incoming bytes
+    /// @param readylist The list used to save the useful data extracted
+    /// @return Return true if some useful data has been extracted successfully (by the first filter)
+    virtual bool Extract(SessionPtr session, IoBufferPtr data, std::vector<IoBufferPtr>& readylist);
+
+    /// Encode the raw buffer (with all the filters in reverse order)
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the raw buffer
+    /// @return The pointer of the IO buffer encoded
+    virtual IoBufferPtr Encode(SessionPtr session, void* data);
+
+    /// Decode the IO buffer (with the last filter)
+    ///
+    /// @param session Current session
+    /// @param data The pointer of the IO buffer encoded
+    /// @return The original raw buffer (a common pointer)
+    virtual void* Decode(SessionPtr session, IoBufferPtr data);
+
+    /// Assign the state slots of the session to the chain and all its filters (see IoFilter::AssignStateSlots())
+    ///
+    /// @param first The first slot which can be used
+    /// @return The next slot which is not used by the chain
+    virtual int AssignStateSlots(int first);
+
+protected:
+private:
+
+    std::vector<IoFilterPtr> m_filters;
+
+    int m_firstslot; // the state slot of the chain itself
+
+};
+
+typedef boost::shared_ptr<IoFilterChain> IoFilterChainPtr;
+
+}
+
+#endif // _ESN_IOFILTERCHAIN_H_
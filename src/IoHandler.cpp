@@ -43,4 +43,24 @@ IoHandler::~IoHandler()
     //dtor
 }
 
+int IoHandler::OnReadBatch(SessionPtr session, IoBufferPtr* msgs, int count, bool& wait)
+{
+    return 0;
+}
+
+bool IoHandler::CanRead(SessionPtr session)
+{
+    return true;
+}
+
+void IoHandler::OnWriteBlocked(SessionPtr session)
+{
+    return;
+}
+
+void IoHandler::OnWritable(SessionPtr session)
+{
+    return;
+}
+
 
@@ -32,9 +32,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "IoService.h"
 
+#ifndef ESN_IOSVC_PROBE_INTERVAL
+#define ESN_IOSVC_PROBE_INTERVAL 100
+#endif
+
 using namespace esnlib;
 
 class IoServiceImpl : public IoService
@@ -51,10 +56,20 @@ public:
 
 	virtual void Stop();
 
+	virtual int GetSessionCount();
+	virtual int AddSessionCount(int delta);
+
+	virtual int GetLoad();
+
 protected:
 
 	void Abort();
 
+	void Probe();
+	void OnProbe(const boost::system::error_code& error);
+
+	void OnStop();
+
 private:
 
 	boost::asio::io_service m_svc;
@@ -63,6 +78,14 @@ private:
 
     boost::thread * m_thread;
 
+	boost::asio::deadline_timer m_probetimer;
+	boost::posix_time::ptime m_probetime;
+
+	boost::mutex m_countmutex;
+
+	int m_sessioncount;
+	int m_load;
+
 	int m_threadstacksize;
 
 };
@@ -73,9 +96,13 @@ IoServiceImpl::IoServiceImpl(int threadStackSize)
 , m_work(m_svc)
 , m_strand(m_svc)
 , m_thread(NULL)
+, m_probetimer(m_svc)
 {
 	m_threadstacksize = threadStackSize;
 	if(m_threadstacksize < 0) m_threadstacksize = 0;
+
+	m_sessioncount = 0;
+	m_load = 0;
 }
 
 IoServiceImpl::~IoServiceImpl()
@@ -107,21 +134,77 @@ void IoServiceImpl::Start()
 		{
 			m_thread = new boost::thread(boost::bind(&boost::asio::io_service::run, &m_svc));
 		}
+
+		// the timer should only be touched on the loop
+		m_svc.post(boost::bind(&IoServiceImpl::Probe, this));
 	}
 }
 
+int IoServiceImpl::GetSessionCount()
+{
+	boost::unique_lock<boost::mutex> lock(m_countmutex);
+	return m_sessioncount;
+}
+
+int IoServiceImpl::AddSessionCount(int delta)
+{
+	boost::unique_lock<boost::mutex> lock(m_countmutex);
+	m_sessioncount += delta;
+	if(m_sessioncount < 0) m_sessioncount = 0;
+	return m_sessioncount;
+}
+
+int IoServiceImpl::GetLoad()
+{
+	boost::unique_lock<boost::mutex> lock(m_countmutex);
+	return m_load;
+}
+
+void IoServiceImpl::Probe()
+{
+	// the probe is a timer on the loop itself, so how late it fires tells us how busy the loop is
+	m_probetime = boost::posix_time::microsec_clock::universal_time()
+	            + boost::posix_time::milliseconds(ESN_IOSVC_PROBE_INTERVAL);
+	m_probetimer.expires_at(m_probetime);
+	m_probetimer.async_wait(boost::bind(&IoServiceImpl::OnProbe, this, boost::asio::placeholders::error));
+}
+
+void IoServiceImpl::OnProbe(const boost::system::error_code& error)
+{
+	if(error) return;
+
+	boost::posix_time::time_duration delay = boost::posix_time::microsec_clock::universal_time() - m_probetime;
+	int lag = (int) delay.total_microseconds();
+	if(lag < 0) lag = 0;
+
+	{
+		boost::unique_lock<boost::mutex> lock(m_countmutex);
+		if(lag > 0 || m_load > 0) m_load = (m_load * 7 + lag) / 8; // smooth it a little
+	}
+
+	Probe();
+}
+
 void IoServiceImpl::Stop()
 {
     if(m_thread)
     {
-        m_svc.reset();
-		m_svc.stop();
+        // cancel the probe and stop the loop on the loop itself
+        m_svc.post(boost::bind(&IoServiceImpl::OnStop, this));
         m_thread->join();
         delete m_thread;
         m_thread = NULL;
+        m_svc.reset(); // so it can be started again
     }
 }
 
+void IoServiceImpl::OnStop()
+{
+    boost::system::error_code ec;
+    m_probetimer.cancel(ec);
+    m_svc.stop();
+}
+
 void IoServiceImpl::Abort()
 {
     if(m_thread)
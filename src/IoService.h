@@ -60,6 +60,22 @@ public:
     ///
 	virtual void Stop() = 0;
 
+    /// Get total number of the live sessions running on the service
+    ///
+    /// @return Total number of the live sessions
+    virtual int GetSessionCount() = 0;
+
+    /// Increase (or decrease) the number of the live sessions running on the service
+    ///
+    /// @param delta The change of the number (a negative value means decrease)
+    /// @return Total number of the live sessions after the change
+    virtual int AddSessionCount(int delta) = 0;
+
+    /// Get recent load of the service's event loop
+    ///
+    /// @return The smoothed delay (in microsecond) of the event loop in recent rounds
+    virtual int GetLoad() = 0;
+
 protected:
 
 private:
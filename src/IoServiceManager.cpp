@@ -42,13 +42,19 @@ class IoServiceManagerImpl : public IoServiceManager
 {
 public:
 
-	explicit IoServiceManagerImpl(int poolsize = 0, int stacksize = 0);
+	explicit IoServiceManagerImpl(int poolsize = 0, int stacksize = 0, int policy = 0);
     virtual ~IoServiceManagerImpl();
 
     virtual IoServicePtr GetService();
+    virtual IoServicePtr GetServiceByIndex(int index);
 
 	virtual int GetServiceCount();
 
+    virtual int GetSessionCount(int index);
+
+    virtual int GetBalancePolicy();
+    virtual void SetBalancePolicy(int policy);
+
 protected:
 
 private:
@@ -61,13 +67,17 @@ private:
 	int m_stacksize;
 
 	int m_index;
+	int m_policy;
 };
 
 
-IoServiceManagerImpl::IoServiceManagerImpl(int poolsize, int stacksize)
+IoServiceManagerImpl::IoServiceManagerImpl(int poolsize, int stacksize, int policy)
 {
 	m_index = 0;
 
+	m_policy = policy;
+	if (m_policy < BALANCE_ROUND_ROBIN || m_policy > BALANCE_LEAST_LOAD) m_policy = BALANCE_ROUND_ROBIN;
+
 	m_stacksize = stacksize;
     if (m_stacksize < 0) m_stacksize = 0;
 
@@ -108,20 +118,81 @@ IoServicePtr IoServiceManagerImpl::GetService()
 	if(!svc)
 	{
 		boost::unique_lock<boost::mutex> lock(m_mutex);
+		if(m_poolsize <= 0) return svc;
+
 		int idx = m_index % m_poolsize;
+
+		if(m_policy != BALANCE_ROUND_ROBIN)
+		{
+			// start scanning from the round-robin index so ties still get spread out
+			int best = -1;
+			int bestsessions = 0;
+			int bestload = 0;
+			for(int i=0; i<m_poolsize; i++)
+			{
+				int current = (m_index + i) % m_poolsize;
+				int sessions = m_svclist[current]->GetSessionCount();
+				int load = m_policy == BALANCE_LEAST_LOAD ? m_svclist[current]->GetLoad() : 0;
+
+				bool better = best < 0;
+				if(!better)
+				{
+					if(m_policy == BALANCE_LEAST_LOAD)
+						better = load < bestload || (load == bestload && sessions < bestsessions);
+					else
+						better = sessions < bestsessions;
+				}
+
+				if(better)
+				{
+					best = current;
+					bestsessions = sessions;
+					bestload = load;
+				}
+			}
+			if(best >= 0) idx = best;
+		}
+
 		svc = m_svclist[idx];
 		m_index++;
 	}
 	return svc;
 }
 
+IoServicePtr IoServiceManagerImpl::GetServiceByIndex(int index)
+{
+	IoServicePtr svc;
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	if(index >= 0 && index < m_poolsize) svc = m_svclist[index];
+	return svc;
+}
+
 int IoServiceManagerImpl::GetServiceCount()
 {
 	return m_poolsize;
 }
 
-esnlib::IoServiceManagerPtr esnlib::CreateIoServiceManager(int poolSize, int svcStackSize)
+int IoServiceManagerImpl::GetSessionCount(int index)
+{
+	IoServicePtr svc = GetServiceByIndex(index);
+	if(svc) return svc->GetSessionCount();
+	else return 0;
+}
+
+int IoServiceManagerImpl::GetBalancePolicy()
+{
+	return m_policy;
+}
+
+void IoServiceManagerImpl::SetBalancePolicy(int policy)
+{
+	if (policy < BALANCE_ROUND_ROBIN || policy > BALANCE_LEAST_LOAD) return;
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	m_policy = policy;
+}
+
+esnlib::IoServiceManagerPtr esnlib::CreateIoServiceManager(int poolSize, int svcStackSize, int balancePolicy)
 {
-    esnlib::IoServiceManagerPtr iosvcmgr(new IoServiceManagerImpl(poolSize, svcStackSize));
+    esnlib::IoServiceManagerPtr iosvcmgr(new IoServiceManagerImpl(poolSize, svcStackSize, balancePolicy));
     return iosvcmgr;
 }
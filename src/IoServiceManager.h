@@ -42,15 +42,44 @@ class IoServiceManager
 {
 public:
 
-    /// Get IoService 
+    enum
+    {
+        BALANCE_ROUND_ROBIN = 0,
+        BALANCE_LEAST_SESSIONS = 1,
+        BALANCE_LEAST_LOAD = 2
+    };
+
+    /// Get IoService (it will be picked out by current balance policy)
     ///
     /// @return The pointer of the IoService
     virtual IoServicePtr GetService() = 0;
 
+    /// Get IoService by its index in the pool
+    ///
+    /// @param index The index of the IoService
+    /// @return The pointer of the IoService
+    virtual IoServicePtr GetServiceByIndex(int index) = 0;
+
 	/// Get pool size
     ///
 	virtual int GetServiceCount() = 0;
 
+    /// Get total number of the live sessions running on the specific IoService
+    ///
+    /// @param index The index of the IoService
+    /// @return Total number of the live sessions of the IoService
+    virtual int GetSessionCount(int index) = 0;
+
+    /// Get the balance policy, which decides how to pick out an IoService for a new session
+    ///
+    /// @return The balance policy: 0 for round-robin, 1 for least sessions, 2 for least load
+    virtual int GetBalancePolicy() = 0;
+
+    /// Set the balance policy, which decides how to pick out an IoService for a new session
+    ///
+    /// @param policy The balance policy: 0 for round-robin, 1 for least sessions, 2 for least load
+    virtual void SetBalancePolicy(int policy) = 0;
+
 protected:
 
 private:
@@ -67,8 +96,9 @@ typedef boost::shared_ptr<IoServiceManager> IoServiceManagerPtr;
 ///
 /// @param poolSize The pool size ("0" means default)
 /// @param svcStackSize The stack size of every IO thread ("0" means default)
+/// @param balancePolicy The balance policy: 0 for round-robin, 1 for least sessions, 2 for least load
 /// @return The pointer of the IO thread pool
-IoServiceManagerPtr CreateIoServiceManager(int poolSize = 0, int svcStackSize = 0);
+IoServiceManagerPtr CreateIoServiceManager(int poolSize = 0, int svcStackSize = 0, int balancePolicy = 0);
 
 /** @} */
 
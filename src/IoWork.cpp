@@ -38,26 +38,52 @@ int IoWork::Run(BufferPtr task)
     int ret = -1;
 	if(task)
 	{
-		IoBufferPtr data =  *((IoBufferPtr*)(&task));
+		IoBufferPtr data = boost::static_pointer_cast<IoBuffer>(task);
 		if(data)
         {
             try { ret = Handle(data); } catch(...) { }
-            SessionPtr session = data->session();
-            if(session)
-            {
-                int datatype = data->type();
-                if(datatype == 1) session->ProcessIncomingData(true);
-                else if(datatype == 2) session->ProcessOutgoingData(true);
-            }
+            ResumeSession(data);
         }
 
 	}
 	return ret;
 }
 
+int IoWork::Drop(BufferPtr task, int waited)
+{
+    int ret = -1;
+	if(task)
+	{
+		IoBufferPtr data = boost::static_pointer_cast<IoBuffer>(task);
+		if(data)
+        {
+            try { ret = HandleExpired(data, waited); } catch(...) { }
+            ResumeSession(data);
+        }
+
+	}
+	return ret;
+}
+
+void IoWork::ResumeSession(IoBufferPtr data)
+{
+    SessionPtr session = data->session();
+    if(session)
+    {
+        int datatype = data->type();
+        if(datatype == 1) session->ProcessIncomingData(true);
+        else if(datatype == 2) session->ProcessOutgoingData(true);
+    }
+}
+
 int IoWork::Handle(IoBufferPtr data)
 {
 	if(data) return 0;
     else return -1;
 }
 
+int IoWork::HandleExpired(IoBufferPtr data, int waited)
+{
+	return -1; // do nothing by default
+}
+
@@ -55,8 +55,27 @@ public:
     /// @return The return code
 	virtual int Handle(IoBufferPtr data);
 
+    /// The callback function for the task which has waited too long in the work manager
+    ///
+    /// @param workdata The working data
+    /// @param waited How long the task has waited since it was added (in milliseconds)
+    /// @return The return code
+    virtual int Drop(BufferPtr workdata, int waited);
+
+    /// The callback function to handle the io data which has expired, a reply like "server busy" could be sent here
+    ///
+    /// @param data The IO data
+    /// @param waited How long the data has waited since it was added (in milliseconds)
+    /// @return The return code
+    virtual int HandleExpired(IoBufferPtr data, int waited);
+
 protected:
 
+    /// Let the session go on processing the data after the async task is done (or dropped)
+    ///
+    /// @param data The IO data
+    void ResumeSession(IoBufferPtr data);
+
 private:
 
 };
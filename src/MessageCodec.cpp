@@ -30,17 +30,104 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <iostream>
+#include <cstring>
+
+#include "LogManager.h"
+#include "IoHandler.h"
 
 #include "MessageCodec.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ESN_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
 using namespace esnlib;
 
+namespace
+{
+
+// CRC32C (Castagnoli), the table is used when the CPU does not have the SSE4.2 crc32 instruction
+class Crc32cTable
+{
+public:
+
+    Crc32cTable()
+    {
+        for(unsigned int i=0; i<256; i++)
+        {
+            unsigned int crc = i;
+            for(int j=0; j<8; j++) crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+            m_table[i] = crc;
+        }
+    }
+
+    unsigned int m_table[256];
+};
+
+unsigned int Crc32cSoft(unsigned int crc, const unsigned char* data, int len)
+{
+    static const Crc32cTable table;
+    for(int i=0; i<len; i++) crc = table.m_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef ESN_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+unsigned int Crc32cHard(unsigned int crc, const unsigned char* data, int len)
+{
+    #ifdef __x86_64__
+    unsigned long long crc64 = crc;
+    while(len >= 8)
+    {
+        unsigned long long value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        len -= 8;
+    }
+    crc = (unsigned int)crc64;
+    #endif
+    while(len >= 4)
+    {
+        unsigned int value;
+        memcpy(&value, data, 4);
+        crc = _mm_crc32_u32(crc, value);
+        data += 4;
+        len -= 4;
+    }
+    while(len > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+        data++;
+        len--;
+    }
+    return crc;
+}
+#endif
+
+unsigned int Crc32c(const char* data, int len)
+{
+    unsigned int crc = 0xffffffff;
+    #ifdef ESN_CRC32C_SSE42
+    static const bool hard = __builtin_cpu_supports("sse4.2");
+    if(hard) crc = Crc32cHard(crc, (const unsigned char*)data, len);
+    else crc = Crc32cSoft(crc, (const unsigned char*)data, len);
+    #else
+    crc = Crc32cSoft(crc, (const unsigned char*)data, len);
+    #endif
+    return crc ^ 0xffffffff;
+}
+
+}
+
 MessageCodec::MessageCodec()
 {
     m_headersize = 4;
     m_bodysizepos = 0;
     m_bodysizelen = 4;
     m_maxbodysize = 1024;
+    m_checksum = false;
 }
 
 MessageCodec::MessageCodec(int headerSize)
@@ -49,6 +136,7 @@ MessageCodec::MessageCodec(int headerSize)
     m_bodysizepos = 0;
     m_bodysizelen = 4;
     m_maxbodysize = 1024;
+    m_checksum = false;
 
     if(m_headersize < 1) m_headersize = 1;
     if(m_bodysizelen > m_headersize) m_bodysizelen = m_headersize;
@@ -59,6 +147,7 @@ MessageCodec::MessageCodec(int headerSize, int bodySizePos)
     m_bodysizepos = bodySizePos;
     m_bodysizelen = 4;
     m_maxbodysize = 1024;
+    m_checksum = false;
 
     if(m_headersize < 1) m_headersize = 1;
     if(m_bodysizelen > m_headersize) m_bodysizelen = m_headersize;
@@ -70,6 +159,7 @@ MessageCodec::MessageCodec(int headerSize, int bodySizePos, int bodySizeLength)
     m_bodysizepos = bodySizePos;
     m_bodysizelen = bodySizeLength;
     m_maxbodysize = 1024;
+    m_checksum = false;
 
     if(m_headersize < 1) m_headersize = 1;
     if(m_bodysizelen < 0) m_bodysizelen = 0;
@@ -83,6 +173,7 @@ MessageCodec::MessageCodec(int headerSize, int bodySizePos, int bodySizeLength,
     m_bodysizepos = bodySizePos;
     m_bodysizelen = bodySizeLength;
     m_maxbodysize = maxBodySize;
+    m_checksum = false;
 
     if(m_headersize < 1) m_headersize = 1;
     if(m_bodysizelen < 0) m_bodysizelen = 0;
@@ -97,15 +188,69 @@ MessageCodec::~MessageCodec()
     //dtor
 }
 
+void MessageCodec::EnableChecksum(bool enabled)
+{
+    m_checksum = enabled;
+}
+
+bool MessageCodec::HasChecksum()
+{
+    return m_checksum;
+}
+
 
 IoBufferPtr MessageCodec::Encode(SessionPtr session, void* data)
 {
     IoBufferPtr newtask;
     IoBuffer* buf = (IoBuffer*)data;
+    if(buf && m_checksum)
+    {
+        // leave room for the checksum, so it can be appended without another copy (see FinishEncoding())
+        int len = buf->size();
+        newtask = session->GetFreeBuffer(len + 4);
+        if(newtask)
+        {
+            newtask->PutBuf(buf->data(), len);
+            newtask->size(len);
+            newtask->SetWritePos(0);
+        }
+        return newtask;
+    }
+    if(buf && buf->IsSlice())
+    {
+        // a slice can be sent as another slice of the same memory (no copy)
+        newtask = CreateIoBufferSlice(buf->GetSource(), buf->GetOffset(), buf->size());
+        return newtask;
+    }
     if(buf) newtask = session->GetFreeBuffer(buf->size());
     if(newtask && buf) newtask->PutBuf(buf->data(), buf->size());
     return newtask;
 }
+IoBufferPtr MessageCodec::FinishEncoding(SessionPtr session, IoBufferPtr data)
+{
+    if(!m_checksum) return data;
+
+    // append the checksum of the whole message,
+    // in place if there is room, or else in a new buffer (a slice should not write beyond its size)
+    IoBufferPtr newtask = data;
+    int len = data->size();
+    if(data->IsSlice() || data->capacity() < len + 4)
+    {
+        newtask = session->GetFreeBuffer(len + 4);
+        if(!newtask) return newtask;
+        newtask->PutBuf(data->data(), len);
+    }
+    else newtask->size(len + 4);
+
+    unsigned int crc = Crc32c(newtask->data(), len);
+    unsigned char* trailer = (unsigned char*)(newtask->data() + len);
+    trailer[0] = crc & 0xff;
+    trailer[1] = (crc >> 8) & 0xff;
+    trailer[2] = (crc >> 16) & 0xff;
+    trailer[3] = (crc >> 24) & 0xff;
+    newtask->SetWritePos(0);
+    return newtask;
+}
 void* MessageCodec::Decode(SessionPtr session, IoBufferPtr data)
 {
     if(data) return (void*)(data.get());
@@ -116,126 +261,71 @@ bool MessageCodec::Extract(SessionPtr session, IoBufferPtr data, std::vector<IoB
 {
     //printf("Start decode ...\n");
 
-    IoBufferPtr cache = session->GetReadCache();
-    //if(!cache) return false;
+    // a message will be extracted only when its header and body are all ready,
+    // and then it will share the memory of the incoming bytes (no copy),
+    // the part of a message which is not ready yet will be left in the incoming bytes for next round
 
     int total = 0;
+    int trailersize = m_checksum ? 4 : 0;
 
-    if (cache->state() == STATE_WAIT_FOR_BODY)
+    while (data->size() - data->GetReadPos() >= m_headersize)
     {
-        int bodylen = cache->flag();
-        if (data->size() - data->GetReadPos() >= bodylen)
+        int bodylen = 0;
+        int currentpos = data->GetReadPos();
+        if(m_bodysizepos >= 0 && m_bodysizelen > 0)
         {
-            //IoTaskPtr newtask(new IoTask(m_headersize + bodylen));
-            IoBufferPtr newtask = session->GetFreeBuffer(m_headersize + bodylen);
-            if(!newtask) return false;
-
-            newtask->PutBuf(cache->data(), m_headersize);
-            newtask->PutBuf(data->data() + data->GetReadPos(), bodylen);
-            readylist.push_back(newtask);
-            total++;
-            data->SetReadPos(data->GetReadPos() + bodylen);
-            cache->state(STATE_WAIT_FOR_HEADER);
-            cache->SetReadPos(0);
-            cache->SetWritePos(0);
-            cache->flag(0);
+            data->SetReadPos(currentpos + m_bodysizepos);
+            if(m_bodysizelen == 1) bodylen = data->GetByte();
+            else if(m_bodysizelen == 2) bodylen = data->GetShort();
+            else bodylen = data->GetInt();
         }
 
-    }
+        //printf("body len: %d ...\n", bodylen);
 
-    while(cache->state() == STATE_WAIT_FOR_HEADER
-            && data->size() - data->GetReadPos() >= m_headersize)
-    {
-        if (cache->state() == STATE_WAIT_FOR_HEADER)
-        {
-            cache->size(m_headersize);
-            cache->SetReadPos(0);
-            cache->SetWritePos(0);
+        if(bodylen < 0) bodylen = 0;
+        if(bodylen > m_maxbodysize) return true;
 
-            if (data->size() - data->GetReadPos() >= m_headersize)
-            {
-                int bodylen = 0;
-                int currentpos = data->GetReadPos();
-                cache->PutBuf(data->data() + currentpos, m_headersize);
-                if(m_bodysizepos >= 0 && m_bodysizelen > 0)
-                {
-                    data->SetReadPos(currentpos + m_bodysizepos);
-                    if(m_bodysizelen == 1) bodylen = data->GetByte();
-                    else if(m_bodysizelen == 2) bodylen = data->GetShort();
-                    else bodylen = data->GetInt();
-                }
-
-                data->SetReadPos(currentpos + m_headersize);
-
-                //printf("body len: %d ...\n", bodylen);
+        if (data->size() - currentpos < m_headersize + bodylen + trailersize)
+        {
+            data->SetReadPos(currentpos); // wait for the rest of the message
+            break;
+        }
 
-                if(bodylen > 0)
-                {
-                    if(bodylen > m_maxbodysize) return true;
+        if(m_checksum)
+        {
+            // verify the message while it is still in cache, drop it if it is broken
+            const unsigned char* trailer = (const unsigned char*)(data->data() + currentpos + m_headersize + bodylen);
+            unsigned int crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned int)trailer[3] << 24);
 
-                    cache->size(m_headersize + bodylen);
-                    if(cache->size() < m_headersize + bodylen) return true;
+            data->SetReadPos(currentpos + m_headersize + bodylen + trailersize);
 
-                    cache->flag(bodylen);
-                    cache->state(STATE_WAIT_FOR_BODY);
-                }
-                else
+            if(crc != Crc32c(data->data() + currentpos, m_headersize + bodylen))
+            {
+                IoHandlerPtr handler;
+                if(session) handler = session->GetIoHandler();
+                if(handler)
                 {
-                    //IoTaskPtr newtask(new IoTask(m_headersize));
-                    IoBufferPtr newtask = session->GetFreeBuffer(m_headersize);
-                    if(!newtask) return true;
-
-                    newtask->PutBuf(cache->data(), m_headersize);
-                    readylist.push_back(newtask);
-                    total++;
-                    cache->state(STATE_WAIT_FOR_HEADER);
-                    cache->SetReadPos(0);
-                    cache->SetWritePos(0);
-                    cache->flag(0);
-                    continue;
+                    try { handler->OnError(session, 1, ERROR_BAD_CHECKSUM, "Message checksum mismatch"); }
+                    catch(...) { LogManager::Warning("Exception found in OnError() event."); }
                 }
-
+                else LogManager::Warning("Message checksum mismatch");
+                continue;
             }
-
         }
 
-        if (cache->state() == STATE_WAIT_FOR_BODY)
-        {
-            int bodylen = cache->flag();
-            if (data->size() - data->GetReadPos() >= bodylen)
-            {
-                //IoTaskPtr newtask(new IoTask(m_headersize + bodylen));
-                IoBufferPtr newtask = session->GetFreeBuffer(m_headersize + bodylen);
-                if(!newtask) return false;
-
-                newtask->PutBuf(cache->data(), m_headersize);
-                newtask->PutBuf(data->data() + data->GetReadPos(), bodylen);
-                readylist.push_back(newtask);
-                total++;
-                data->SetReadPos(data->GetReadPos() + bodylen);
-                cache->state(STATE_WAIT_FOR_HEADER);
-                cache->SetReadPos(0);
-                cache->SetWritePos(0);
-                cache->flag(0);
-                continue;
-            }
+        IoBufferPtr newtask = CreateIoBufferSlice(data, currentpos, m_headersize + bodylen);
+        if(newtask->size() < m_headersize + bodylen) return true;
 
-        }
+        readylist.push_back(newtask);
+        total++;
 
+        data->SetReadPos(currentpos + m_headersize + bodylen + trailersize);
     }
 
     //printf("End decode ...\n");
 
     if (total > 0 && data->size() - data->GetReadPos() <= 0) return true;
 
-    if (cache->state() != STATE_WAIT_FOR_HEADER && cache->state() != STATE_WAIT_FOR_BODY)
-    {
-        std::cout << "MessageCodec::Decode(): Wrong message state found! The session will be closed." << std::endl;
-        session->Close();
-    }
-
     return false;
 }
 
-
-
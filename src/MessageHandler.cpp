@@ -32,25 +32,61 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //#include <cstdio>
 #include <sstream>
 
+#include <boost/bind.hpp>
+#include <boost/thread/tss.hpp>
+
 #include "LogManager.h"
 
 #include "MessageHandler.h"
 
 using namespace esnlib;
 
+static void keep_current_batch(MessageTaskBatch* batch)
+{
+    // the batch is on the stack of OnReadBatch(), so do nothing here
+}
+
+// the batch being collected by OnReadBatch() in current thread
+static boost::thread_specific_ptr<MessageTaskBatch> current_batch(keep_current_batch);
+
+static void resume_session_read(SessionRef ref)
+{
+    SessionPtr session = ref.lock();
+    if(session) session->ResumeRead();
+}
+
+/// The tasks collected by OnReadBatch() in one thread, the ones in a row with the same work, priority and serial key
+/// will be added to the work manager together
+class esnlib::MessageTaskBatch
+{
+public:
+    MessageTaskBatch(MessageHandler* handler): m_handler(handler), m_priority(0), m_timeout(0), m_serial(false), m_key(0) {}
+
+    MessageHandler* m_handler; // the handler which is collecting the tasks
+
+    WorkPtr m_work;
+    int m_priority;
+    int m_timeout;
+    bool m_serial;
+    int m_key;
+
+    std::vector<BufferPtr> m_tasks;
+};
+
 MessageHandler::MessageHandler()
+: m_pausereadonwriteblocked(false)
 {
     //ctor
 }
 
 MessageHandler::MessageHandler(WorkManagerPtr manager)
-: m_manager(manager)
+: m_manager(manager), m_pausereadonwriteblocked(false)
 {
     //ctor
 }
 
 MessageHandler::MessageHandler(WorkManagerPtr manager, WorkPtr work)
-: m_manager(manager), m_work(work)
+: m_manager(manager), m_work(work), m_pausereadonwriteblocked(false)
 {
     //ctor
 }
@@ -71,6 +107,15 @@ WorkPtr MessageHandler::GetDefaultWork()
     return m_work;
 }
 
+bool MessageHandler::GetReadPauseOnWriteBlocked()
+{
+    return m_pausereadonwriteblocked;
+}
+void MessageHandler::SetReadPauseOnWriteBlocked(bool value)
+{
+    m_pausereadonwriteblocked = value;
+}
+
 int MessageHandler::GetCode(IoBuffer* data)
 {
     return 0;
@@ -88,10 +133,80 @@ std::string MessageHandler::GetStrKey(IoBuffer* data)
 {
     return "";
 }
+int MessageHandler::GetPriority(IoBuffer* data)
+{
+    return WORK_PRIORITY_NORMAL;
+}
+int MessageHandler::GetTaskTimeout(IoBuffer* data)
+{
+    return 0; // no limit by default
+}
 bool MessageHandler::IsOrderlyMessage(IoBuffer* data)
 {
     return false; // assume the message is NOT orderly by default
 }
+
+int MessageHandler::GetSerialKey(SessionPtr session, IoBuffer* data)
+{
+    int key = session->GetId();
+    if(key == 0) key = (int)(((size_t)session.get()) >> 4); // the id of a client session may not be set
+    return key;
+}
+
+int MessageHandler::AddMessageTask(SessionPtr session, WorkPtr work, IoBufferPtr data, int optype)
+{
+    data->SetReadPos(0);
+    bool orderly = IsOrderlyMessage(data.get()) && session->GetOrderlyHandling(optype);
+
+    data->SetReadPos(0);
+    int priority = GetPriority(data.get());
+
+    data->SetReadPos(0);
+    int timeout = GetTaskTimeout(data.get());
+
+    data->SetReadPos(0);
+    data->SetWritePos(0);
+
+    data->type(0); // the session does not need to wait for the task, so no callback is needed
+
+    int key = orderly ? GetSerialKey(session, data.get()) : 0;
+
+    MessageTaskBatch* batch = current_batch.get();
+    if(batch && batch->m_handler == this)
+    {
+        if(!batch->m_tasks.empty())
+        {
+            if(batch->m_work != work || batch->m_priority != priority || batch->m_timeout != timeout
+               || batch->m_serial != orderly || batch->m_key != key) FlushMessageTasks(batch);
+        }
+
+        batch->m_work = work;
+        batch->m_priority = priority;
+        batch->m_timeout = timeout;
+        batch->m_serial = orderly;
+        batch->m_key = key;
+        batch->m_tasks.push_back(data);
+    }
+    else
+    {
+        if(orderly) m_manager->AddSerialWorkTask(key, work, data, priority, timeout);
+        else m_manager->AddWorkTask(work, data, priority, timeout);
+    }
+
+    return 1 | 2; // async process, and the session can go on processing the rest
+}
+
+void MessageHandler::FlushMessageTasks(MessageTaskBatch* batch)
+{
+    if(!batch || batch->m_tasks.empty()) return;
+
+    if(batch->m_serial) m_manager->AddSerialWorkTasks(batch->m_key, batch->m_work, batch->m_tasks, batch->m_priority, batch->m_timeout);
+    else m_manager->AddWorkTasks(batch->m_work, batch->m_tasks, batch->m_priority, batch->m_timeout);
+
+    batch->m_tasks.clear();
+    batch->m_work.reset();
+}
+
 void MessageHandler::HandleMessage(SessionPtr session, IoBufferPtr data)
 {
     return;
@@ -111,19 +226,7 @@ int MessageHandler::DefaultAsyncProcessOnWrite(SessionPtr session, IoBufferPtr d
             data->code(code);
             data->flag(flag);
 
-            data->SetReadPos(0);
-            data->SetWritePos(0);
-
-            flags = flags | 1; // async process
-            if(!IsOrderlyMessage(data.get()) || !session->GetOrderlyHandling(2))
-            {
-                flags = flags | 2; // disordered messages support concurrency
-                data->type(0); // concurrency needs data with no type
-            }
-
-            m_manager->AddWorkTask(m_work, data); // async process data in another thread
-
-            return flags;
+            return AddMessageTask(session, m_work, data, 2); // async process data in another thread
         }
         else
         {
@@ -140,19 +243,7 @@ int MessageHandler::DefaultAsyncProcessOnWrite(SessionPtr session, IoBufferPtr d
 
             if(work)
             {
-                data->SetReadPos(0);
-                data->SetWritePos(0);
-
-                flags = flags | 1; // async process
-                if(!IsOrderlyMessage(data.get()) || !session->GetOrderlyHandling(2))
-                {
-                    flags = flags | 2; // disordered messages support concurrency
-                    data->type(0); // concurrency needs data with no type
-                }
-
-                m_manager->AddWorkTask(work, data); // async process data in another thread
-
-                return flags;
+                return AddMessageTask(session, work, data, 2); // async process data in another thread
             }
         }
     }
@@ -178,19 +269,7 @@ int MessageHandler::OnRead(SessionPtr session, IoBufferPtr data)
             data->code(code);
             data->flag(flag);
 
-            data->SetReadPos(0);
-            data->SetWritePos(0);
-
-            flags = flags | 1; // async process
-            if(!IsOrderlyMessage(data.get()) || !session->GetOrderlyHandling(1))
-            {
-                flags = flags | 2; // disordered messages support concurrency
-                data->type(0); // concurrency needs data with no type
-            }
-
-            m_manager->AddWorkTask(m_work, data); // async process data in another thread
-
-            return flags;
+            return AddMessageTask(session, m_work, data, 1); // async process data in another thread
         }
         else
         {
@@ -207,19 +286,7 @@ int MessageHandler::OnRead(SessionPtr session, IoBufferPtr data)
 
             if(work)
             {
-                data->SetReadPos(0);
-                data->SetWritePos(0);
-
-                flags = flags | 1; // async process
-                if(!IsOrderlyMessage(data.get()) || !session->GetOrderlyHandling(1))
-                {
-                    flags = flags | 2; // disordered messages support concurrency
-                    data->type(0); // concurrency needs data with no type
-                }
-
-                m_manager->AddWorkTask(work, data); // async process data in another thread
-
-                return flags;
+                return AddMessageTask(session, work, data, 1); // async process data in another thread
             }
         }
     }
@@ -231,6 +298,64 @@ int MessageHandler::OnRead(SessionPtr session, IoBufferPtr data)
     return flags;
 
 }
+int MessageHandler::OnReadBatch(SessionPtr session, IoBufferPtr* msgs, int count, bool& wait)
+{
+    MessageTaskBatch batch(this);
+
+    // OnRead() of another handler may be collecting tasks in this thread too
+    MessageTaskBatch* outer = current_batch.get();
+    if(m_manager) current_batch.reset(&batch);
+
+    int handled = 0;
+
+    try
+    {
+        while(handled < count)
+        {
+            // it will be processed in sync, or in a serial queue, or with concurrency
+            int flags = OnRead(session, msgs[handled]);
+            handled++;
+
+            // async without concurrency, the session has to wait for it
+            if((flags & 3) == 1)
+            {
+                wait = true;
+                break;
+            }
+        }
+    }
+    catch(...)
+    {
+        LogManager::Warning( "Exception found in OnRead() event." );
+        handled++; // skip the bad one
+    }
+
+    if(m_manager)
+    {
+        current_batch.reset(outer);
+        FlushMessageTasks(&batch);
+    }
+
+    return handled;
+}
+
+bool MessageHandler::CanRead(SessionPtr session)
+{
+    // do not take more requests from a peer which is not taking our replies
+    if(m_pausereadonwriteblocked && !session->IsWritable()) return false;
+
+    if(!m_manager || !m_manager->IsOverloaded()) return true;
+
+    // keep the new data in the socket (not in our memory) until the work manager has done enough tasks
+    return m_manager->WaitForAdmission(boost::bind(resume_session_read, SessionRef(session)));
+}
+
+void MessageHandler::OnWritable(SessionPtr session)
+{
+    // if the work manager is still overloaded, the session will be stopped again after this round
+    if(m_pausereadonwriteblocked) session->ResumeRead();
+}
+
 int MessageHandler::OnWrite(SessionPtr session, IoBufferPtr data)
 {
     //printf("OnWrite: %d \n", data->size());
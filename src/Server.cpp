@@ -52,8 +52,45 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "Server.h"
 
+#ifndef ESN_ACCEPTOR_STOP_TIMEOUT
+#define ESN_ACCEPTOR_STOP_TIMEOUT 5000
+#endif
+
 using namespace esnlib;
 
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+class ServerImpl;
+
+/// An acceptor of the reuse-port mode, it runs on the loop of an IO service
+///
+/// It is shared by the server and its pending accept handler, so if the server has to give it up
+/// (e.g. stopped on the loop of the acceptor itself), the handler still owns it and will find the server gone.
+class ServerAcceptor
+{
+public:
+
+    ServerAcceptor(boost::asio::io_service* iosvc): m_acceptor(*iosvc), m_iosvc(iosvc), m_server(NULL), m_pending(0) {}
+
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::io_service* m_iosvc;
+
+    ServerImpl* m_server; // NULL after the server has given it up
+    boost::recursive_mutex m_servermutex; // held by the accept handler while it is using the server
+
+    int m_pending; // how many accepts are pending (with lock(m_acceptmutex) of the server)
+};
+
+typedef boost::shared_ptr<ServerAcceptor> ServerAcceptorPtr;
+
+static void close_acceptor(ServerAcceptorPtr acceptor)
+{
+    boost::system::error_code ec;
+    acceptor->m_acceptor.close(ec);
+}
+
 Server::Server()
 {
     // ...
@@ -68,7 +105,7 @@ class ServerImpl : public Server
 {
 public:
     ServerImpl();
-    ServerImpl(int connectQueueSize, int readBufferSize, int writeBufferSize);
+    ServerImpl(int connectQueueSize, int readBufferSize, int writeBufferSize, bool reusePort);
     virtual ~ServerImpl();
 
     virtual bool Start(const std::string& ipstr, int port);
@@ -110,7 +147,17 @@ protected:
 
     bool Listen();
 
-    void OnAccept(SessionPtr session, const boost::system::error_code& error);
+    bool ListenOnServices();
+
+    void SetAcceptorOptions(boost::asio::ip::tcp::acceptor * acceptor);
+
+    ClientSessionPtr NewSession(int index = -1);
+
+    void Accept(int index);
+
+    void OnAccept(SessionPtr session, int index, const boost::system::error_code& error);
+
+    static void OnAcceptorAccept(ServerAcceptorPtr acceptor, SessionPtr session, int index, const boost::system::error_code& error);
 
     std::string OnGetSslPassword() const;
 
@@ -120,6 +167,12 @@ private:
 
     boost::asio::ip::tcp::acceptor * m_acceptor;
 
+    // the acceptors of the reuse-port mode, one for each IO service in m_svclist
+    std::vector<ServerAcceptorPtr> m_acceptors;
+
+    boost::mutex m_acceptmutex;
+    boost::condition_variable m_acceptcondition;
+
     #ifdef ESN_WITH_SSL
     boost::asio::ssl::context * m_context;
     boost::asio::io_service::strand * m_strand;
@@ -136,7 +189,7 @@ private:
     boost::thread * m_listenthread;
     boost::thread * m_iothread;
 
-    std::list<IoServicePtr> m_svclist;
+    std::vector<IoServicePtr> m_svclist;
 
     SessionManager m_climgr;
 
@@ -158,6 +211,8 @@ private:
 
     int m_cnnqueuesize;
 
+    bool m_reuseport;
+
     bool m_gotssl;
     std::string m_sslpwd;
 
@@ -193,9 +248,11 @@ ServerImpl::ServerImpl()
     m_writebufsize = ESN_DEFAULT_SOCK_BUFSIZE;
 
     m_cnnqueuesize = boost::asio::socket_base::max_connections;
+
+    m_reuseport = false;
 }
 
-ServerImpl::ServerImpl(int connectQueueSize, int readBufferSize, int writeBufferSize)
+ServerImpl::ServerImpl(int connectQueueSize, int readBufferSize, int writeBufferSize, bool reusePort)
 {
     m_endpoint = NULL;
 
@@ -231,6 +288,8 @@ ServerImpl::ServerImpl(int connectQueueSize, int readBufferSize, int writeBuffer
     m_cnnqueuesize = connectQueueSize;
     if(m_cnnqueuesize <= 0) m_cnnqueuesize = boost::asio::socket_base::max_connections;
 
+    m_reuseport = reusePort;
+
 }
 
 ServerImpl::~ServerImpl()
@@ -275,7 +334,7 @@ IoBufferPtr ServerImpl::GetFreeBuffer(int bufsize)
     }
     else
     {
-        IoBufferPtr newtask(new IoBuffer(bufsize));
+        IoBufferPtr newtask = CreateIoBuffer(bufsize);
         task = newtask;
     }
     return task;
@@ -376,11 +435,23 @@ bool ServerImpl::Listen()
     #endif
     m_svclist.clear();
 
-    IoServicePtr svc;
     boost::asio::io_service* iosvc = NULL;
 
-    if(!m_svcmgr)
+    if(m_svcmgr && m_svcmgr->GetServiceCount() > 0)
     {
+        // every new session will be put on one of the pool's services (see NewSession())
+        for(int i=0; i<m_svcmgr->GetServiceCount(); i++)
+        {
+            IoServicePtr svc = m_svcmgr->GetServiceByIndex(i);
+            if(svc) m_svclist.push_back(svc);
+        }
+        if(m_svclist.size() > 0) iosvc = (boost::asio::io_service*)(m_svclist.front()->GetRunner());
+    }
+
+    if(iosvc == NULL)
+    {
+        m_svclist.clear();
+
         m_iosvc = new boost::asio::io_service();
         m_iowork = new boost::asio::io_service::work(*m_iosvc);
 
@@ -390,29 +461,16 @@ bool ServerImpl::Listen()
 
         iosvc = m_iosvc;
     }
-    else
-    {
-        if(m_svcmgr)
-        {
-            svc = m_svcmgr->GetService();
-            if(svc)
-            {
-                m_svclist.push_back(svc);
-                iosvc = (boost::asio::io_service*)(svc->GetRunner());
-            }
-        }
 
-        if(iosvc == NULL)
-        {
-            m_iosvc = new boost::asio::io_service();
-            m_iowork = new boost::asio::io_service::work(*m_iosvc);
-
-            #ifdef ESN_WITH_SSL
-            m_strand = new boost::asio::io_service::strand(*m_iosvc);
-            #endif
-
-            iosvc = m_iosvc;
-        }
+    if(m_reuseport && m_svclist.size() > 0)
+    {
+        #ifdef SO_REUSEPORT
+        delete m_listensvc;
+        m_listensvc = NULL;
+        return ListenOnServices();
+        #else
+        LogManager::Warning("SO_REUSEPORT is not supported on this platform, will listen with one acceptor.");
+        #endif
     }
 
     m_acceptor = new boost::asio::ip::tcp::acceptor(*m_listensvc);
@@ -504,59 +562,10 @@ bool ServerImpl::Listen()
         m_currentport = m_endpoint->port();
         m_currentip = m_endpoint->address().to_string();
 
-        boost::asio::socket_base::receive_buffer_size option1(m_readbufsize);
-        boost::system::error_code ec1;
-        m_acceptor->set_option(option1, ec1);
-        //if(ec1) std::cout << "Error when set acceptor receive_buffer_size(" << m_readbufsize << "): " << ec1.message() << std::endl;
-        if(ec1)
-        {
-            std::stringstream ss;
-            ss << "Error when set acceptor receive_buffer_size(" << m_readbufsize << "): " << ec1.message();
-            LogManager::Warning(ss.str());
-        }
-
-        boost::asio::socket_base::send_buffer_size option2(m_writebufsize);
-        boost::system::error_code ec2;
-        m_acceptor->set_option(option2, ec2);
-        //if(ec2) std::cout << "Error when set acceptor send_buffer_size(" << m_writebufsize << "): " << ec2.message() << std::endl;
-        if(ec2)
-        {
-            std::stringstream ss;
-            ss << "Error when set acceptor send_buffer_size(" << m_writebufsize << "): " << ec2.message();
-            LogManager::Warning(ss.str());
-        }
-    }
-
-    ClientSessionPtr session;
-
-    #ifdef ESN_WITH_SSL
-    if(m_gotssl && m_context != NULL)
-    {
-        boost::asio::io_service::strand * keeper = NULL;
-        if(m_iosvc != NULL && m_iosvc == iosvc) keeper = m_strand;
-        else if(svc) keeper = (boost::asio::io_service::strand*)(svc->GetOrderSustainer());
-        ClientSessionPtr newSession(new ClientSession(*iosvc, *m_context, keeper, m_climgr, m_readbufsize, m_writebufsize, true));
-        session = newSession;
-    }
-    else
-    {
-        ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
-        session = newSession;
+        SetAcceptorOptions(m_acceptor);
     }
-    #else
-    if(!m_gotssl)
-    {
-        ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
-        session = newSession;
-    }
-    #endif
 
-    session->SetIoHandler(m_handler);
-    session->SetIoFilter(m_filter);
-    session->SetBufferManager(m_bufmgr);
-    m_acceptor->async_accept(session->GetSocket(),
-        boost::bind(&ServerImpl::OnAccept, this, session,
-          boost::asio::placeholders::error));
+    Accept(-1);
 
     m_listenthread = new boost::thread(boost::bind(&boost::asio::io_service::run, m_listensvc));
 
@@ -579,6 +588,95 @@ bool ServerImpl::Listen()
 
     return true;
 }
+bool ServerImpl::ListenOnServices()
+{
+    #ifdef SO_REUSEPORT
+
+    // open one acceptor on every IO service with SO_REUSEPORT,
+    // so the kernel will balance the connections and every acceptor accepts right on its own loop
+    boost::system::error_code ec;
+
+    int count = m_svclist.size();
+    for(int i=0; i<count && !ec; i++)
+    {
+        boost::asio::io_service* iosvc = (boost::asio::io_service*)(m_svclist[i]->GetRunner());
+        ServerAcceptorPtr acceptor(new ServerAcceptor(iosvc));
+        acceptor->m_server = this;
+        m_acceptors.push_back(acceptor);
+
+        acceptor->m_acceptor.open(m_endpoint->protocol(), ec);
+        if(!ec) acceptor->m_acceptor.set_option(reuse_port(true), ec);
+        if(!ec) acceptor->m_acceptor.bind(*m_endpoint, ec);
+        if(!ec) acceptor->m_acceptor.listen(m_cnnqueuesize, ec);
+    }
+
+    if(ec)
+    {
+        for(size_t i=0; i<m_acceptors.size(); i++)
+        {
+            boost::system::error_code ignored;
+            m_acceptors[i]->m_acceptor.close(ignored);
+        }
+        m_acceptors.clear();
+
+        m_svclist.clear();
+
+        std::stringstream ss;
+        ss << "Failed to listen on "
+              << m_endpoint->address().to_string() << ":"
+              << m_endpoint->port() << " with SO_REUSEPORT - "
+              << ec.message();
+        LogManager::Warning(ss.str());
+
+        delete m_endpoint;
+        m_endpoint = NULL;
+
+        return false;
+    }
+
+    m_currentport = m_endpoint->port();
+    m_currentip = m_endpoint->address().to_string();
+
+    for(int i=0; i<count; i++) SetAcceptorOptions(&(m_acceptors[i]->m_acceptor));
+
+    for(int i=0; i<count; i++) Accept(i);
+
+    std::stringstream ss;
+    ss << "Listening on " << m_endpoint->port() << " with " << count << " acceptors";
+    LogManager::Info(ss.str());
+
+    return true;
+
+    #else
+    return false;
+    #endif
+}
+
+void ServerImpl::SetAcceptorOptions(boost::asio::ip::tcp::acceptor * acceptor)
+{
+    boost::asio::socket_base::receive_buffer_size option1(m_readbufsize);
+    boost::system::error_code ec1;
+    acceptor->set_option(option1, ec1);
+    //if(ec1) std::cout << "Error when set acceptor receive_buffer_size(" << m_readbufsize << "): " << ec1.message() << std::endl;
+    if(ec1)
+    {
+        std::stringstream ss;
+        ss << "Error when set acceptor receive_buffer_size(" << m_readbufsize << "): " << ec1.message();
+        LogManager::Warning(ss.str());
+    }
+
+    boost::asio::socket_base::send_buffer_size option2(m_writebufsize);
+    boost::system::error_code ec2;
+    acceptor->set_option(option2, ec2);
+    //if(ec2) std::cout << "Error when set acceptor send_buffer_size(" << m_writebufsize << "): " << ec2.message() << std::endl;
+    if(ec2)
+    {
+        std::stringstream ss;
+        ss << "Error when set acceptor send_buffer_size(" << m_writebufsize << "): " << ec2.message();
+        LogManager::Warning(ss.str());
+    }
+}
+
 bool ServerImpl::Start(int port)
 {
     if(port <= 0) return false;
@@ -618,6 +716,51 @@ bool ServerImpl::Start(const std::string& ipstr, int port)
 
 void ServerImpl::Stop()
 {
+    if(m_acceptors.size() > 0)
+    {
+        std::vector<ServerAcceptorPtr> acceptors;
+        {
+            // no more new accepts after this
+            boost::unique_lock<boost::mutex> lock(m_acceptmutex);
+            acceptors.swap(m_acceptors);
+        }
+
+        // the acceptors are running on the IO services' threads, so close them there (or right now if it is on the loop),
+        // and wait for the pending accepts (except the ones of current loop, they can not go on until it returns)
+        std::vector<ServerAcceptorPtr> waitlist;
+        for(size_t i=0; i<acceptors.size(); i++)
+        {
+            ServerAcceptorPtr acceptor = acceptors[i];
+            if(acceptor->m_iosvc->get_executor().running_in_this_thread()) close_acceptor(acceptor);
+            else
+            {
+                acceptor->m_iosvc->post(boost::bind(close_acceptor, acceptor));
+                waitlist.push_back(acceptor);
+            }
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_acceptmutex);
+
+            boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(ESN_ACCEPTOR_STOP_TIMEOUT);
+            size_t done = 0;
+            while(done < waitlist.size())
+            {
+                if(waitlist[done]->m_pending <= 0) done++;
+                else if(!m_acceptcondition.timed_wait(lock, deadline)) break;
+            }
+
+            if(done < waitlist.size()) LogManager::Warning("Timeout when waiting for the acceptors to stop.");
+        }
+
+        // give them up, the pending handlers (if any) own them now and will not touch the server any more
+        for(size_t i=0; i<acceptors.size(); i++)
+        {
+            boost::unique_lock<boost::recursive_mutex> lock(acceptors[i]->m_servermutex);
+            acceptors[i]->m_server = NULL;
+        }
+    }
+
     if(m_acceptor)
     {
         m_acceptor->close();
@@ -698,6 +841,7 @@ void ServerImpl::Stop()
 
 bool ServerImpl::Listening()
 {
+    if(m_acceptors.size() > 0) return m_currentport > 0;
     return m_acceptor && m_acceptor->is_open();
 }
 
@@ -807,57 +951,139 @@ void ServerImpl::SetIdleTime(int idletype, int idletime)
     m_climgr.SetIdleTime(idletype, idletime);
 }
 
-void ServerImpl::OnAccept(SessionPtr session, const boost::system::error_code& error)
+ClientSessionPtr ServerImpl::NewSession(int index)
 {
+    // the acceptor of the reuse-port mode keeps the session on its own IO service,
+    // otherwise pick out the IO service for the next session by the balance policy of the IO service manager
     IoServicePtr svc;
     boost::asio::io_service* iosvc = NULL;
-    if(m_svclist.size() > 0)
+    if(index >= 0 && index < (int)m_svclist.size())
     {
-        svc = m_svclist.front();
+        svc = m_svclist[index];
         if(svc) iosvc = (boost::asio::io_service*)(svc->GetRunner());
     }
-    if(iosvc == NULL) iosvc = m_iosvc;
+    else if(m_svclist.size() > 0 && m_svcmgr)
+    {
+        svc = m_svcmgr->GetService();
+        if(svc) iosvc = (boost::asio::io_service*)(svc->GetRunner());
+    }
+    if(iosvc == NULL)
+    {
+        svc.reset();
+        iosvc = m_iosvc;
+    }
 
-    if (!error && m_acceptor && iosvc)
+    ClientSessionPtr session;
+    if(iosvc == NULL) return session;
+
+    #ifdef ESN_WITH_SSL
+    if(m_gotssl && m_context != NULL)
     {
-        session->Open();
+        boost::asio::io_service::strand * keeper = NULL;
+        if(m_iosvc != NULL && m_iosvc == iosvc) keeper = m_strand;
+        else if(svc) keeper = (boost::asio::io_service::strand*)(svc->GetOrderSustainer());
+        ClientSessionPtr newSession(new ClientSession(*iosvc, *m_context, keeper, m_climgr, m_readbufsize, m_writebufsize, true));
+        session = newSession;
+    }
+    else
+    {
+        ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
+        session = newSession;
+    }
+    #else
+    if(!m_gotssl)
+    {
+        ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
+        session = newSession;
+    }
+    #endif
 
-        ClientSessionPtr newone;
+    if(session)
+    {
+        session->SetIoHandler(m_handler);
+        session->SetIoFilter(m_filter);
+        session->SetBufferManager(m_bufmgr);
+        if(svc) session->SetIoService(svc);
+    }
 
-        #ifdef ESN_WITH_SSL
-        if(m_gotssl && m_context != NULL)
-        {
-            boost::asio::io_service::strand * keeper = NULL;
-            if(m_iosvc != NULL && m_iosvc == iosvc) keeper = m_strand;
-            else if(svc) keeper = (boost::asio::io_service::strand*)(svc->GetOrderSustainer());
-            ClientSessionPtr newSession(new ClientSession(*iosvc, *m_context, keeper, m_climgr, m_readbufsize, m_writebufsize, true));
-            newone = newSession;
-        }
-        else
-        {
-            ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
-            newone = newSession;
-        }
-        #else
-        if(!m_gotssl)
+    return session;
+}
+
+void ServerImpl::Accept(int index)
+{
+    ServerAcceptorPtr acceptor;
+
+    if(index >= 0)
+    {
+        boost::unique_lock<boost::mutex> lock(m_acceptmutex);
+        if(index < (int)m_acceptors.size() && m_acceptors[index]->m_acceptor.is_open())
         {
-            ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
-            newone = newSession;
+            acceptor = m_acceptors[index];
+            acceptor->m_pending++;
         }
-        #endif
+        if(!acceptor) return;
+    }
+    else if(!m_acceptor) return;
 
-        newone->SetIoHandler(m_handler);
-        newone->SetIoFilter(m_filter);
-        newone->SetBufferManager(m_bufmgr);
-        m_acceptor->async_accept(newone->GetSocket(),
-          boost::bind(&ServerImpl::OnAccept, this, newone,
+    ClientSessionPtr session = NewSession(index);
+
+    if(session)
+    {
+        // the handler of the reuse-port mode keeps its acceptor (see Stop())
+        if(acceptor) acceptor->m_acceptor.async_accept(session->GetSocket(),
+          boost::bind(&ServerImpl::OnAcceptorAccept, acceptor, session, index,
             boost::asio::placeholders::error));
+        else m_acceptor->async_accept(session->GetSocket(),
+          boost::bind(&ServerImpl::OnAccept, this, session, index,
+            boost::asio::placeholders::error));
+    }
+    else if(acceptor)
+    {
+        boost::unique_lock<boost::mutex> lock(m_acceptmutex);
+        acceptor->m_pending--;
+        m_acceptcondition.notify_all();
+    }
+}
+
+void ServerImpl::OnAcceptorAccept(ServerAcceptorPtr acceptor, SessionPtr session, int index, const boost::system::error_code& error)
+{
+    // the server may have given up the acceptor (see Stop()), then it should not be touched any more
+    boost::unique_lock<boost::recursive_mutex> lock(acceptor->m_servermutex);
 
+    ServerImpl* server = acceptor->m_server;
+    if(!server) return;
+
+    server->OnAccept(session, index, error);
+
+    if(acceptor->m_server)
+    {
+        // only now the server can give up the acceptor without waiting (see Stop())
+        boost::unique_lock<boost::mutex> acceptlock(server->m_acceptmutex);
+        acceptor->m_pending--;
+        server->m_acceptcondition.notify_all();
+    }
+}
+
+void ServerImpl::OnAccept(SessionPtr session, int index, const boost::system::error_code& error)
+{
+    bool accepting = m_acceptor != NULL;
+
+    if(index >= 0)
+    {
+        boost::unique_lock<boost::mutex> lock(m_acceptmutex);
+        accepting = index < (int)m_acceptors.size() && m_acceptors[index]->m_acceptor.is_open();
+    }
+
+    if (!error && accepting)
+    {
+        session->Open();
+
+        Accept(index);
     }
     else if(error)
     {
         int errorType = 0;
-        if(!m_acceptor || !iosvc || error == boost::asio::error::operation_aborted) errorType = -1;
+        if(!accepting || error == boost::asio::error::operation_aborted) errorType = -1;
 
         if(m_handler)
         {
@@ -869,39 +1095,7 @@ void ServerImpl::OnAccept(SessionPtr session, const boost::system::error_code& e
 
         if(errorType >= 0)
         {
-            if(m_acceptor && iosvc)
-            {
-                ClientSessionPtr newone;
-
-                #ifdef ESN_WITH_SSL
-                if(m_gotssl && m_context != NULL)
-                {
-                    boost::asio::io_service::strand * keeper = NULL;
-                    if(m_iosvc != NULL && m_iosvc == iosvc) keeper = m_strand;
-                    else if(svc) keeper = (boost::asio::io_service::strand*)(svc->GetOrderSustainer());
-                    ClientSessionPtr newSession(new ClientSession(*iosvc, *m_context, keeper, m_climgr, m_readbufsize, m_writebufsize, true));
-                    newone = newSession;
-                }
-                else
-                {
-                    ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
-                    newone = newSession;
-                }
-                #else
-                if(!m_gotssl)
-                {
-                    ClientSessionPtr newSession(new ClientSession(*iosvc, m_climgr, m_readbufsize, m_writebufsize, true));
-                    newone = newSession;
-                }
-                #endif
-
-                newone->SetIoHandler(m_handler);
-                newone->SetIoFilter(m_filter);
-                newone->SetBufferManager(m_bufmgr);
-                m_acceptor->async_accept(newone->GetSocket(),
-                  boost::bind(&ServerImpl::OnAccept, this, newone,
-                    boost::asio::placeholders::error));
-            }
+            Accept(index);
         }
         else
         {
@@ -911,9 +1105,9 @@ void ServerImpl::OnAccept(SessionPtr session, const boost::system::error_code& e
     }
 }
 
-esnlib::ServerPtr esnlib::CreateServer(int maxConnectQueueSize, int readBufferSize, int writeBufferSize)
+esnlib::ServerPtr esnlib::CreateServer(int maxConnectQueueSize, int readBufferSize, int writeBufferSize, bool reusePort)
 {
-    esnlib::ServerPtr svr(new ServerImpl(maxConnectQueueSize, readBufferSize, writeBufferSize));
+    esnlib::ServerPtr svr(new ServerImpl(maxConnectQueueSize, readBufferSize, writeBufferSize, reusePort));
     return svr;
 }
 
@@ -178,8 +178,9 @@ typedef boost::shared_ptr<Server> ServerPtr;
 /// @param maxConnectQueueSize The maximum size of the connection queue
 /// @param readBufferSize The size of the read buffer
 /// @param writeBufferSize The size of the write buffer
+/// @param reusePort Whether open one SO_REUSEPORT acceptor on every IO service of the IO thread pool (it needs an IO thread pool)
 /// @return The pointer of the server
-ServerPtr CreateServer(int maxConnectQueueSize = 2048, int readBufferSize = 8192, int writeBufferSize = 8192);
+ServerPtr CreateServer(int maxConnectQueueSize = 2048, int readBufferSize = 8192, int writeBufferSize = 8192, bool reusePort = false);
 
 /** @} */
 
@@ -71,6 +71,9 @@ public:
 
     /// Write data
     ///
+    /// The buffer can be a slice, but it should not be written to more than one session,
+    /// please create a slice for each session (see CreateIoBufferSlice()) instead.
+    ///
     /// @param data The data (a buffer pointer)
     virtual void Write(boost::shared_ptr<IoBuffer> data) = 0;
 
@@ -80,6 +83,11 @@ public:
     /// @param bufsize The size of the buffer
     virtual void Write(const char* buf, int bufsize) = 0;
 
+    /// Write data made up of chained segments (they will be sent out in order, no other data will get in between)
+    ///
+    /// @param chain The segments (buffer pointers)
+    virtual void Write(const std::vector< boost::shared_ptr<IoBuffer> >& chain) = 0;
+
     /// Write data
     ///
     /// @param data The data (a common pointer)
@@ -163,6 +171,43 @@ public:
     /// @param value The max message queue size
     virtual void SetMaxMessageQueueSize(int optype, int value) = 0;
 
+    /// Get the limit of gather-write (queued buffers will be sent out together in one write)
+    ///
+    /// @param limittype The limit type: 1 for max number of the buffers, 2 for max total bytes
+    /// @return The limit value
+    virtual int GetGatherWriteLimit(int limittype) = 0;
+
+    /// Set the limit of gather-write (queued buffers will be sent out together in one write)
+    ///
+    /// @param limittype The limit type: 1 for max number of the buffers, 2 for max total bytes
+    /// @param value The limit value ("1" buffer means no gather-write)
+    virtual void SetGatherWriteLimit(int limittype, int value) = 0;
+
+    /// Get the watermark of the outgoing data queued (the ones being sent included)
+    ///
+    /// @param marktype The watermark type: 1 for high, 2 for low
+    /// @return The watermark value (in bytes)
+    virtual int GetWriteWatermark(int marktype) = 0;
+
+    /// Set the watermark of the outgoing data queued, the session is blocked (see IsWritable()) when the data
+    /// reaches the high watermark, and it will be writable again when the data falls below the low watermark
+    ///
+    /// @param marktype The watermark type: 1 for high, 2 for low
+    /// @param value The watermark value (in bytes, "0" high watermark means never blocked)
+    virtual void SetWriteWatermark(int marktype, int value) = 0;
+
+    /// Get total bytes of the outgoing data queued (the ones being sent included)
+    ///
+    /// @return The total bytes
+    virtual int GetWriteQueueBytes() = 0;
+
+    /// Check whether the session is writable (the outgoing data queued has not reached the high watermark).
+    /// A session which is not writable still takes new data (till the max message queue size),
+    /// but the writer should wait for the OnWritable() event of the IO handler
+    ///
+    /// @return Return true if the session is writable
+    virtual bool IsWritable() = 0;
+
     /// Get the session's state
     ///
     /// @return The session state
@@ -178,7 +223,7 @@ public:
     /// @return The pointer of the IO handler
     virtual boost::shared_ptr<IoHandler> GetIoHandler() = 0;
 
-    /// Get the read cache
+    /// Get the read cache (it will be created when it is asked for the first time)
     ///
     /// @return The pointer of the read cache (IO buffer)
     virtual boost::shared_ptr<IoBuffer> GetReadCache() = 0;
@@ -226,6 +271,18 @@ public:
     /// @return The pointer of the local data
     virtual CommonDataPtr GetData() = 0;
 
+    /// Get the state of an IO filter kept in the session (see IoFilter::GetSessionState())
+    ///
+    /// @param slot The state slot of the IO filter
+    /// @return The pointer of the state (empty if it is not set yet)
+    virtual boost::shared_ptr<Business> GetFilterState(int slot) = 0;
+
+    /// Set the state of an IO filter kept in the session (it will be released with the session)
+    ///
+    /// @param slot The state slot of the IO filter
+    /// @param state The pointer of the state
+    virtual void SetFilterState(int slot, boost::shared_ptr<Business> state) = 0;
+
     /// Check whether the session has global data attached
     ///
     /// @return Return true if the session has global data
@@ -256,6 +313,10 @@ public:
     /// @return The port of the local side
     virtual int GetLocalPort() = 0;
 
+    /// Resume reading incoming data, if the session has stopped reading because its IO handler asked it to wait
+    /// (see IoHandler::CanRead())
+    virtual void ResumeRead() = 0;
+
     /// Process incoming data
     ///
     /// @param asynccall It is an async call or not
@@ -250,11 +250,17 @@ SessionPtr SessionManager::GetFirstSession()
 
 void SessionManager::Broadcast(IoBufferPtr data)
 {
+    if(!data) return;
+
+    // every session gets its own slice of the data (no copy),
+    // so they will not share (and change) the same buffer object in their write queues
     boost::unique_lock<boost::mutex> lock(m_sessionmutex);
-    std::for_each(m_sessions.begin(), m_sessions.end(),
-        boost::bind(&Session::WriteBuffer,
-                    boost::bind(&std::map<int,SessionPtr>::value_type::second, _1),
-                    data));
+    std::map<int,SessionPtr>::iterator itr = m_sessions.begin();
+    while(itr != m_sessions.end())
+    {
+        itr->second->WriteBuffer(CreateIoBufferSlice(data, 0, data->size()));
+        itr++;
+    }
 }
 
 void SessionManager::Broadcast(void* data)
@@ -38,15 +38,24 @@ using namespace esnlib;
 StringCodec::StringCodec()
 {
     //ctor
-    m_separator = '\n';
+    m_separator = "\n";
     m_maxstrlen = 1024;
 }
 
 StringCodec::StringCodec(char separator, int maxstrlen)
+{
+    //ctor
+    m_separator = std::string(1, separator);
+    m_maxstrlen = maxstrlen;
+}
+
+StringCodec::StringCodec(const std::string& separator, int maxstrlen)
 {
     //ctor
     m_separator = separator;
     m_maxstrlen = maxstrlen;
+
+    if(m_separator.empty()) m_separator = "\n";
 }
 
 StringCodec::~StringCodec()
@@ -61,11 +70,11 @@ IoBufferPtr StringCodec::Encode(SessionPtr session, void* data)
 
     char* buf = (char*)data;
     int len = strlen(buf);
-    newtask = session->GetFreeBuffer(len + 1);
+    newtask = session->GetFreeBuffer(len + m_separator.length());
     if(newtask)
     {
         newtask->PutBuf(buf, len);
-        newtask->PutByte(m_separator);
+        newtask->PutStr(m_separator);
         newtask->SetWritePos(0);
     }
     return newtask;
@@ -86,55 +95,73 @@ void* StringCodec::Decode(SessionPtr session, IoBufferPtr data)
     return data->data();
 }
 
+const char* StringCodec::FindSeparator(const char* buf, int len)
+{
+    // memchr() is vectorized (SSE2/AVX2) by the C library already, so let it find the first char of the separator
+    int seplen = m_separator.length();
+    const char* sep = m_separator.data();
+
+    const char* current = buf;
+    const char* end = buf + len;
+
+    while(end - current >= seplen)
+    {
+        current = (const char*)memchr(current, sep[0], (end - current) - seplen + 1);
+        if(!current) return NULL;
+        if(seplen == 1 || memcmp(current + 1, sep + 1, seplen - 1) == 0) return current;
+        current++;
+    }
+
+    return NULL;
+}
+
 bool StringCodec::Extract(SessionPtr session, IoBufferPtr data, std::vector<IoBufferPtr>& readylist)
 {
-    IoBufferPtr cache = session->GetReadCache();
+    // the strings extracted will share the memory of the incoming bytes (no copy),
+    // and the unfinished string will be left in the incoming bytes for next round
 
     int total = 0;
 
+    int maxlen = m_maxstrlen > 0 ? m_maxstrlen : 1;
+    int seplen = m_separator.length();
+
     while(data->size() - data->GetReadPos() > 0)
     {
-        char ch = data->GetByte();
-        if(ch == m_separator)
+        int currentpos = data->GetReadPos();
+        int leftsize = data->size() - currentpos;
+
+        // the separator may begin right after the longest string
+        int scansize = leftsize < maxlen + seplen ? leftsize : maxlen + seplen;
+
+        const char* start = data->data() + currentpos;
+        const char* found = FindSeparator(start, scansize);
+
+        if(found && found - start <= maxlen)
         {
-            if(cache->size() > 0)
+            int len = found - start;
+            if(len > 0)
             {
-                IoBufferPtr newtask = session->GetFreeBuffer(cache->size());
-                if(!newtask) return false;
-
-                newtask->PutBuf(cache->data(), cache->size());
+                // keep the separator's place in the capacity, so Decode() can put '\0' there without copying
+                IoBufferPtr newtask = CreateIoBufferSlice(data, currentpos, len + seplen);
+                newtask->size(len);
                 readylist.push_back(newtask);
                 total++;
-                cache->size(0);
-                cache->SetReadPos(0);
-                cache->SetWritePos(0);
-                cache->flag(0);
             }
+            data->SetReadPos(currentpos + len + seplen);
         }
-        else
+        else if(found || scansize >= maxlen + seplen)
         {
-            cache->size(cache->size() + 1);
-            cache->PutByte(ch);
-
-            if(cache->size() >= m_maxstrlen)
-            {
-                IoBufferPtr newtask = session->GetFreeBuffer(cache->size());
-                if(!newtask) return false;
-
-                newtask->PutBuf(cache->data(), cache->size());
-                readylist.push_back(newtask);
-                total++;
-                cache->size(0);
-                cache->SetReadPos(0);
-                cache->SetWritePos(0);
-                cache->flag(0);
-            }
+            IoBufferPtr newtask = CreateIoBufferSlice(data, currentpos, maxlen);
+            readylist.push_back(newtask);
+            total++;
+            data->SetReadPos(currentpos + maxlen);
         }
+        else break;
     }
 
     //printf("End decode ...\n");
 
-    if (total > 0 && cache->size() <= 0) return true;
+    if (total > 0 && data->size() - data->GetReadPos() <= 0) return true;
 
     return false;
 
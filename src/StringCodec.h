@@ -32,12 +32,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef _ESN_STRINGCODEC_H_
 #define _ESN_STRINGCODEC_H_
 
+#include <string>
+
 #include "IoFilter.h"
 
 namespace esnlib
 {
 
-/// Common String Codec Filter class, a filter who can extract a string(ends with specific char) from incoming bytes
+/// Common String Codec Filter class, a filter who can extract a string(ends with specific char or chars) from incoming bytes
 class StringCodec : public IoFilter
 {
 public:
@@ -51,6 +53,12 @@ public:
     /// @param maxstrlen The maximum length of the string
     StringCodec(char separator, int maxstrlen);
 
+    /// Constructor function
+    ///
+    /// @param separator The separator, chars that the string will end with (such as "\r\n")
+    /// @param maxstrlen The maximum length of the string
+    StringCodec(const std::string& separator, int maxstrlen);
+
     /// Destructor function
     virtual ~StringCodec();
 
@@ -79,7 +87,14 @@ public:
 protected:
 private:
 
-    char m_separator;
+    /// Find the first complete separator in the bytes
+    ///
+    /// @param buf The bytes
+    /// @param len The number of the bytes
+    /// @return The pointer of the separator found (NULL if not found)
+    const char* FindSeparator(const char* buf, int len);
+
+    std::string m_separator;
     int m_maxstrlen;
 
 };
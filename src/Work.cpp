@@ -52,3 +52,8 @@ int Work::Run(BufferPtr task)
     else return -1;
 }
 
+int Work::Drop(BufferPtr task, int waited)
+{
+    return -1;
+}
+
@@ -29,18 +29,94 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 -----------------------------------------------------------------------------
 */
 
-#include <list>
+#include <map>
+#include <deque>
 #include <vector>
+#include <algorithm>
 
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
 
+#include "LogManager.h"
+
 #include "WorkManager.h"
 
 using namespace esnlib;
 
 class WorkManagerImpl;
+class SerialQueue;
+
+/// A task waiting in the queue of a worker
+class WorkTask
+{
+public:
+    WorkTask(): m_priority(WORK_PRIORITY_NORMAL), m_bytes(0), m_addtime(0), m_deadline(0), m_serial(NULL) {}
+    WorkTask(WorkPtr work, BufferPtr data, int priority, long long deadline)
+    : m_work(work), m_data(data), m_priority(priority), m_bytes(data ? data->datasize() : 0), m_addtime(0), m_deadline(deadline), m_serial(NULL) {}
+    WorkTask(SerialQueue* serial, int priority, long long deadline)
+    : m_priority(priority), m_bytes(0), m_addtime(0), m_deadline(deadline), m_serial(serial) {}
+
+    // when it should be done, a task without deadline is due in ESN_WORK_DEFAULT_DUE_TIME
+    long long GetDueTime() const { return m_deadline > 0 ? m_deadline : m_addtime + ESN_WORK_DEFAULT_DUE_TIME; }
+
+    WorkPtr m_work;
+    BufferPtr m_data;
+
+    int m_priority;
+    int m_bytes; // the size of the data, it is counted in the load of the work manager
+
+    long long m_addtime; // when it was put into the queue of a worker (in milliseconds)
+    long long m_deadline; // it will be dropped if it can not start before the deadline (0 means no deadline)
+
+    SerialQueue* m_serial; // if it is set, the task is to run the next one of the serial queue
+};
+
+/// Compare the deadlines of the tasks, it makes the heap of the tasks with deadlines (earliest first)
+class WorkTaskLater
+{
+public:
+    bool operator()(const WorkTask& a, const WorkTask& b) const { return a.m_deadline > b.m_deadline; }
+};
+
+/// The task counters and the scheduling policy shared by all workers
+class WorkSchedule
+{
+public:
+    WorkSchedule();
+
+    // the most urgent priority class which has waiting tasks (-1 if there is nothing)
+    int GetTopClass();
+
+    boost::atomic<int> m_taskcount; // tasks waiting in the workers
+    boost::atomic<int> m_classcounts[WORK_PRIORITY_COUNT];
+
+    volatile int m_policy; // 0: strict priority, 1: weighted-fair
+    volatile int m_weights[WORK_PRIORITY_COUNT];
+};
+
+/// The tasks with the same key, only one of them can be running at any time
+class SerialQueue
+{
+public:
+    SerialQueue(int key): m_key(key), m_running(false) {}
+
+    int m_key;
+    bool m_running; // whether a task of the queue is waiting in a worker or running
+    std::deque<WorkTask> m_tasks;
+};
+
+/// A part of all serial queues (selected by the key), so the queues with different keys will not always share one lock
+class SerialBucket
+{
+public:
+    boost::mutex m_mutex;
+    std::map<int, SerialQueue*> m_queues;
+};
 
 class Worker
 {
@@ -48,34 +124,54 @@ private:
     boost::thread * m_thread;
 
     boost::mutex m_mutex;
-    boost::condition_variable m_condition;
+    std::deque<WorkTask> m_tasks[WORK_PRIORITY_COUNT]; // the tasks without deadline (first in first out)
+    std::vector<WorkTask> m_deadlinetasks[WORK_PRIORITY_COUNT]; // the heaps of the tasks with deadlines
+    int m_credits[WORK_PRIORITY_COUNT]; // how many tasks of each class can still be taken in this round (weighted-fair)
 
     WorkManagerImpl* m_mgr;
-    int m_state; // -1: invalid, 0: stopping, 1: ready, 2: running
+    int m_index;
+    volatile int m_state; // -1: invalid, 0: stopping, 1: ready
+    volatile bool m_active; // false if its thread has retired (for being idle too long)
     int m_stacksize;
-    std::list<BufferPtr> m_tasks;
-    std::list<WorkPtr> m_works;
 
 public:
 
-    Worker(WorkManagerImpl* mgr, int stacksize = 16 * 1024);
+    Worker(WorkManagerImpl* mgr, int index, int stacksize = 16 * 1024);
     virtual ~Worker();
 
     virtual int GetState() const;
     virtual void* GetThread() const;
 
-    void SetWorkTask(WorkPtr work, BufferPtr task);
+    WorkManagerImpl* GetManager() const;
+    int GetIndex() const;
 
-    int Start();
+    bool IsActive() const;
+
+    // the thread is going to end for being idle too long, but the worker (and its queue) will stay
+    void Retire();
+
+    // start a new thread for the retired worker
+    void Restart();
 
-    int DoWork();
-    void WaitForNewWork();
+    // put the tasks at the end of the queues of their classes (the task counters will be updated with the same lock)
+    void PushTasks(const WorkTask* tasks, int count, WorkSchedule& schedule);
 
-    void GoToWork();
+    // take the oldest tasks of the class (or the classes selected by the policy if it is -1),
+    // the owner can take up to "maxcount" tasks, and a thief ("half" = true) takes half of them at most
+    int PopTasks(std::vector<WorkTask>& tasks, int priority, int maxcount, bool half, WorkSchedule& schedule);
+
+    int Start();
 
     int Stop();
     int Abort();
 
+private:
+
+    int GetClassSize(int priority) const;
+
+    // take the task which is due first from the class (with the lock)
+    void TakeTask(int priority, std::vector<WorkTask>& tasks);
+
 };
 
 class WorkManagerImpl : public WorkManager
@@ -84,56 +180,126 @@ private:
 
     int m_stacksize;
 
-    //int m_maxqueuesize;
-
     int m_minworkercount;
     int m_maxworkercount;
 
-    std::list<WorkPtr> m_works;
-    std::list<BufferPtr> m_tasks;
-    std::vector<Worker*> m_workers;
-    std::list<Worker*> m_freelist;
+    std::vector<Worker*> m_workers; // all slots are allocated at the beginning, so the thieves can read them without a lock
+    boost::atomic<int> m_slotcount; // slots having a worker (retired ones included)
+    boost::atomic<int> m_workercount; // workers having a running thread
+    boost::atomic<unsigned int> m_nextworker;
+
+    int m_idletimeout; // in seconds
+    boost::atomic<long long> m_lastspawntime; // in milliseconds
+
+    WorkSchedule m_schedule;
+    boost::atomic<int> m_serialcount; // tasks waiting in the serial queues
+    boost::atomic<long long> m_expiredcount; // tasks dropped for being expired
+    boost::atomic<int> m_spinners; // workers looking for tasks
+    boost::atomic<int> m_sleepers; // workers waiting for the signal
+
+    boost::atomic<long long> m_loadcount; // tasks added and not finished yet
+    boost::atomic<long long> m_loadbytes; // total bytes of their data
+    long long m_maxloadcount;
+    long long m_maxloadbytes;
+    long long m_resumeloadcount;
+    long long m_resumeloadbytes;
+    boost::atomic<bool> m_overloaded;
+    std::vector<AdmissionCallback> m_admissionwaiters;
+    boost::mutex m_admissionmutex;
+
+    boost::condition_variable m_parkcondition;
+    boost::mutex m_parkmutex;
 
-    int m_workreq;
-
-    //semaphore m_dispatcher;
-    boost::condition_variable m_condition;
-    boost::thread * m_dispatcherthread;
-    boost::mutex m_dispatchermutex;
-
-    boost::mutex m_taskmutex;
     boost::mutex m_workmutex;
     boost::mutex m_workermutex;
 
     std::map<int, WorkPtr> m_intworkmap;
     std::map<std::string, WorkPtr> m_strworkmap;
 
+    SerialBucket m_serialbuckets[ESN_WORK_SERIAL_BUCKETS];
+
     BufferManagerPtr m_bufmgr;
 
-    int m_state; // -1: invalid, 0: stopping, 1: ready, 2: running
+    volatile int m_state; // -1: invalid, 0: stopping, 1: ready, 2: running
 
 protected:
 
+    // start a new worker (or restart a retired one) if it is allowed
+    bool AddWorker();
+
+    // let the idle worker retire if there are still enough workers
+    bool RetireWorker(Worker* worker);
+
+    // put the task into a worker's queue and wake up someone to do it
+    int ScheduleTask(const WorkTask& task);
+    int ScheduleTasks(const WorkTask* tasks, int count);
+
+    SerialBucket& GetSerialBucket(int key);
+
+    // run the next task of the serial queue, and schedule the queue again if there are more
+    int RunSerialTask(SerialQueue* serial);
+
+    bool StealTasks(Worker* thief, std::vector<WorkTask>& tasks, int priority, int maxcount);
+
+    // how many tasks a worker can take at a time, the rest are left for the other idle ones to steal
+    // ("spinning" = true if the worker itself is counted as a spinner)
+    int GetTakeCount(bool spinning);
+
+    // take some tasks from the worker's own queue or from the others
+    bool TakeTasks(Worker* worker, std::vector<WorkTask>& tasks, bool spinning = false);
+
+    void WakeUp(bool all = false);
+
+    // wake up some sleeping workers (one by one)
+    void WakeUpSome(int count);
+
+    // count the tasks added, the work manager may become overloaded
+    void AdmitTasks(int count, long long bytes);
+
+    bool IsOverLimit() const;
+    bool IsUnderResumeLimit() const;
+
 public:
     WorkManagerImpl(int minworkercount, int maxworkercount, int workstack);
     virtual ~WorkManagerImpl();
 
-    int TakeBack(Worker* worker);
     void TakeBack(BufferPtr buf);
 
-    void WaitForWork();
+    // run the task in current thread
+    int RunTask(WorkTask& task);
 
-    int Dispatch();
-    int StopDispaching();
+    // count the tasks finished, and resume the waiting ones if the load has gone down
+    void ReleaseTasks(int count, long long bytes);
+
+    // get the next tasks for the worker (it will spin and then sleep if there is nothing to do)
+    // return false if the work manager is stopping or the worker is retiring
+    bool FindTasks(Worker* worker, std::vector<WorkTask>& tasks);
 
-    //int start();
     virtual int Stop();
     virtual int Abort();
 
     virtual int GetState();
     virtual int GetWorkerCount();
+    virtual int GetIdleWorkerCount();
     virtual int GetTaskCount();
-    virtual int AddWorkTask(WorkPtr work, BufferPtr workdata);
+    virtual long long GetExpiredTaskCount();
+
+    virtual long long GetTaskLoad(int loadtype);
+    virtual long long GetTaskLimit(int limittype);
+    virtual void SetTaskLimit(int limittype, long long maxvalue, long long resumevalue);
+    virtual bool IsOverloaded();
+    virtual bool WaitForAdmission(const AdmissionCallback& callback);
+
+    virtual int AddWorkTask(WorkPtr work, BufferPtr workdata, int priority, int timeout);
+    virtual int AddWorkTasks(WorkPtr work, std::vector<BufferPtr>& workdata, int priority, int timeout);
+    virtual int AddSerialWorkTask(int key, WorkPtr work, BufferPtr workdata, int priority, int timeout);
+    virtual int AddSerialWorkTasks(int key, WorkPtr work, std::vector<BufferPtr>& workdata, int priority, int timeout);
+
+    virtual int GetIdleTimeout();
+    virtual void SetIdleTimeout(int seconds);
+
+    virtual void SetSchedulingPolicy(int policy);
+    virtual void SetPriorityWeight(int priority, int weight);
 
     virtual void SetBufferManager(BufferManagerPtr manager);
 
@@ -146,48 +312,48 @@ public:
 };
 
 
+static void keep_current_worker(Worker* worker)
+{
+    // the worker is owned by its work manager, so do nothing here
+}
 
-static void * worker_thread_func( void * ptr )
+static boost::thread_specific_ptr<Worker> current_worker(keep_current_worker);
+
+static long long get_current_ms()
 {
-    if(!ptr) return NULL;
-    Worker* worker = (Worker*) ptr;
-    int ret = worker->Start();
-    return (void*) ret;
+    // a monotonic clock, it is cheap enough to stamp every task (and will not jump with the system time)
+    return boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(
+               boost::asio::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-static void * dispatcher_thread_func( void * ptr )
+static void * worker_thread_func( void * ptr )
 {
     if(!ptr) return NULL;
-    WorkManagerImpl* man = (WorkManagerImpl*) ptr;
-    int ret = man->Dispatch();
+    Worker* worker = (Worker*) ptr;
+    current_worker.reset(worker);
+    int ret = worker->Start();
+    current_worker.reset();
     return (void*) ret;
 }
 
 
-Worker::Worker(WorkManagerImpl* mgr, int stacksize)
+Worker::Worker(WorkManagerImpl* mgr, int index, int stacksize)
 {
     m_mgr = mgr;
+    m_index = index;
+
+    for(int i=0; i<WORK_PRIORITY_COUNT; i++) m_credits[i] = 0;
+
     m_stacksize = stacksize;
     if(m_stacksize < 0) m_stacksize = 0;
 
     m_thread = NULL;
 
-    //m_state = -1;
     m_state = 1;
 
-    if(m_stacksize > 0)
-    {
-        boost::thread::attributes attrs;
-        attrs.set_stack_size(stacksize);
-        m_thread = new boost::thread(attrs, boost::bind(worker_thread_func, this));
-    }
-    else
-    {
-        m_thread = new boost::thread(boost::bind(worker_thread_func, this));
-    }
+    m_active = false;
 
-
-    //m_state = 1;
+    Restart();
 
 }
 
@@ -195,8 +361,11 @@ Worker::~Worker()
 {
     if(m_state > 0) Abort();
 
-    m_works.clear();
-    m_tasks.clear();
+    for(int i=0; i<WORK_PRIORITY_COUNT; i++)
+    {
+        m_tasks[i].clear();
+        m_deadlinetasks[i].clear();
+    }
 
     if(m_thread)
     {
@@ -214,86 +383,215 @@ void* Worker::GetThread() const
     return (void*)&m_thread;
 }
 
-int Worker::Start()
+WorkManagerImpl* Worker::GetManager() const
 {
-    int ret = 0;
-
-    //if(m_works.size() == 0 || m_tasks.size() == 0) this->Sleep();
+    return m_mgr;
+}
+int Worker::GetIndex() const
+{
+    return m_index;
+}
 
-    while(m_state > 0)
-    {
-        WaitForNewWork();
-        ret = DoWork();
-    }
-    return ret;
+bool Worker::IsActive() const
+{
+    return m_active;
 }
 
-void Worker::SetWorkTask(WorkPtr work, BufferPtr task)
+void Worker::Retire()
 {
-    m_works.push_back(work);
-    m_tasks.push_back(task);
+    m_active = false;
 }
 
-int Worker::DoWork()
+void Worker::Restart()
 {
-    if(m_state <= 0) return 0;
+    if(m_active || m_state <= 0) return;
 
-    //m_state = 2;
+    if(m_thread)
+    {
+        m_thread->join(); // the old thread has left its loop already
+        delete m_thread;
+        m_thread = NULL;
+    }
 
-    int ret = 0;
+    m_active = true;
 
-    if(m_works.size() > 0 && m_tasks.size() > 0)
+    if(m_stacksize > 0)
     {
-        WorkPtr work = m_works.front();
-        BufferPtr task = m_tasks.front();
-        ret = work->Run(task);
-        while(!m_tasks.empty()) m_tasks.pop_front();
-        while(!m_works.empty()) m_works.pop_front();
+        boost::thread::attributes attrs;
+        attrs.set_stack_size(m_stacksize);
+        m_thread = new boost::thread(attrs, boost::bind(worker_thread_func, this));
+    }
+    else
+    {
+        m_thread = new boost::thread(boost::bind(worker_thread_func, this));
+    }
+}
+
+void Worker::PushTasks(const WorkTask* tasks, int count, WorkSchedule& schedule)
+{
+    // every task needs a timestamp, the due time of a task without deadline is counted from it
+    long long now = get_current_ms();
 
-        if(task->recyclable())
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    for(int i=0; i<count; i++)
+    {
+        const WorkTask& task = tasks[i];
+        std::vector<WorkTask>& heap = m_deadlinetasks[task.m_priority];
+        if(task.m_deadline > 0)
         {
-            if(m_mgr) m_mgr->TakeBack(task);
+            heap.push_back(task);
+            if(heap.back().m_addtime == 0) heap.back().m_addtime = now; // keep the first one, so Drop() gets the real wait
+            std::push_heap(heap.begin(), heap.end(), WorkTaskLater());
         }
+        else
+        {
+            m_tasks[task.m_priority].push_back(task);
+            if(m_tasks[task.m_priority].back().m_addtime == 0) m_tasks[task.m_priority].back().m_addtime = now;
+        }
+        schedule.m_classcounts[task.m_priority]++;
     }
+    schedule.m_taskcount += count;
+}
 
-    return ret;
+int Worker::GetClassSize(int priority) const
+{
+    return m_tasks[priority].size() + m_deadlinetasks[priority].size();
 }
-void Worker::WaitForNewWork()
+
+void Worker::TakeTask(int priority, std::vector<WorkTask>& tasks)
+{
+    std::deque<WorkTask>& fifo = m_tasks[priority];
+    std::vector<WorkTask>& heap = m_deadlinetasks[priority];
+
+    if(!heap.empty() && (fifo.empty() || heap.front().GetDueTime() <= fifo.front().GetDueTime()))
+    {
+        std::pop_heap(heap.begin(), heap.end(), WorkTaskLater());
+        tasks.push_back(heap.back());
+        heap.pop_back();
+    }
+    else
+    {
+        tasks.push_back(fifo.front());
+        fifo.pop_front();
+    }
+}
+
+int Worker::PopTasks(std::vector<WorkTask>& tasks, int priority, int maxcount, bool half, WorkSchedule& schedule)
 {
     boost::unique_lock<boost::mutex> lock(m_mutex);
 
-    if(m_state <= 0) return;
+    if(half)
+    {
+        int total = 0;
+        if(priority >= 0 && priority < WORK_PRIORITY_COUNT) total = GetClassSize(priority);
+        else for(int i=0; i<WORK_PRIORITY_COUNT; i++) total += GetClassSize(i);
+        if(maxcount > (total + 1) / 2) maxcount = (total + 1) / 2;
+    }
 
-    bool needtakeback = m_state > 1;
+    int count = 0;
 
-    m_state = 1;
+    while(count < maxcount)
+    {
+        int selected = priority;
+
+        if(selected < 0)
+        {
+            // the most urgent one which has tasks (and credits if it is weighted-fair)
+            bool strict = schedule.m_policy == 0;
+            for(int round=0; round<2 && selected < 0; round++)
+            {
+                bool found = false;
+                for(int i=0; i<WORK_PRIORITY_COUNT; i++)
+                {
+                    if(GetClassSize(i) == 0) continue;
+                    found = true;
+                    if(strict || m_credits[i] > 0)
+                    {
+                        selected = i;
+                        break;
+                    }
+                }
+
+                if(!found) break;
+
+                // all classes having tasks have used up their credits, start a new round
+                if(selected < 0) for(int i=0; i<WORK_PRIORITY_COUNT; i++) m_credits[i] = schedule.m_weights[i];
+            }
+        }
+
+        if(selected < 0 || selected >= WORK_PRIORITY_COUNT || GetClassSize(selected) == 0) break;
 
-    //printf("\nWAIT: %d\n", (int)&m_thread);
-    if(m_mgr && needtakeback) m_mgr->TakeBack(this);
+        TakeTask(selected, tasks);
+        if(m_credits[selected] > 0) m_credits[selected]--;
+
+        schedule.m_classcounts[selected]--;
+        count++;
+    }
 
-    while(m_state == 1) m_condition.wait(lock);
+    schedule.m_taskcount -= count;
+
+    return count;
 }
 
-void Worker::GoToWork()
+WorkSchedule::WorkSchedule()
 {
-    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_taskcount = 0;
+    for(int i=0; i<WORK_PRIORITY_COUNT; i++) m_classcounts[i] = 0;
+
+    m_policy = 1;
+
+    m_weights[WORK_PRIORITY_HIGH] = 16;
+    m_weights[WORK_PRIORITY_NORMAL] = 4;
+    m_weights[WORK_PRIORITY_LOW] = 1;
+}
+
+int WorkSchedule::GetTopClass()
+{
+    for(int i=0; i<WORK_PRIORITY_COUNT; i++)
+    {
+        if(m_classcounts[i] > 0) return i;
+    }
+    return -1;
+}
+
+int Worker::Start()
+{
+    int ret = 0;
+
+    std::vector<WorkTask> tasks;
+    tasks.reserve(ESN_WORK_BATCH_SIZE);
+
+    while(m_state > 0 && m_mgr && m_mgr->FindTasks(this, tasks))
+    {
+        int done = 0;
+        long long bytes = 0;
 
-    if(m_state <= 0) return;
-    m_state = 2;
+        int count = tasks.size();
+        for(int i=0; i<count; i++)
+        {
+            if(!tasks[i].m_serial)
+            {
+                done++; // the task of a serial queue is counted when it is run
+                bytes += tasks[i].m_bytes;
+            }
+            ret = m_mgr->RunTask(tasks[i]);
+            tasks[i] = WorkTask(); // release the task as soon as it is done
+        }
+        tasks.clear();
 
-    m_condition.notify_one();
+        m_mgr->ReleaseTasks(done, bytes); // update the load once for the batch
+    }
+    return ret;
 }
 
 int Worker::Stop()
 {
-    // lock nothing coz care nothing ...
+    // the manager has sent out the signal already, just wait for the end
 
     if(m_state <= 0) return m_state;
     m_state = 0;
 
-    m_condition.notify_one(); // just send out a signal
-
-    if(m_thread) m_thread->join(); // and wait for end
+    if(m_thread) m_thread->join();
 
     m_state = -1;
     return m_state;
@@ -308,7 +606,6 @@ int Worker::Abort()
 
     if(m_thread) m_thread->interrupt(); // force to get out
 
-    //usleep(50 * 1000);
     return m_state;
 }
 
@@ -319,8 +616,6 @@ WorkManagerImpl::WorkManagerImpl(int minworkercount, int maxworkercount, int wor
     m_stacksize = workstack;
     if(m_stacksize < 0) m_stacksize = 0;
 
-    //m_maxqueuesize = maxqueuesize;
-
     m_minworkercount = minworkercount;
     m_maxworkercount = maxworkercount;
 
@@ -332,55 +627,63 @@ WorkManagerImpl::WorkManagerImpl(int minworkercount, int maxworkercount, int wor
     if (m_maxworkercount <= 0) m_maxworkercount = cores * 2;
     if (m_maxworkercount <= 0) m_maxworkercount = 2;
 
-    m_dispatcherthread = NULL;
+    if (m_maxworkercount < m_minworkercount) m_maxworkercount = m_minworkercount;
+
+    m_workers.resize(m_maxworkercount, NULL);
+    m_slotcount = 0;
+    m_workercount = 0;
+    m_nextworker = 0;
 
-    m_workreq = 0;
+    m_idletimeout = ESN_WORK_IDLE_TIMEOUT;
+    m_lastspawntime = 0;
+
+    m_serialcount = 0;
+    m_expiredcount = 0;
+    m_spinners = 0;
+    m_sleepers = 0;
+
+    m_loadcount = 0;
+    m_loadbytes = 0;
+    m_maxloadcount = 0;
+    m_maxloadbytes = 0;
+    m_resumeloadcount = 0;
+    m_resumeloadbytes = 0;
+    m_overloaded = false;
 
-    //m_state = -1;
     m_state = 1;
 
     for(int i=1; i<=m_minworkercount; i++)
     {
-        Worker* worker = new Worker(this, m_stacksize);
-        m_workers.push_back(worker);
-        m_freelist.push_back(worker);
+        m_lastspawntime = 0; // no limit for the minimum ones
+        AddWorker();
     }
 
-    if(m_stacksize > 0)
-    {
-        boost::thread::attributes attrs;
-        attrs.set_stack_size(m_stacksize);
-        m_dispatcherthread = new boost::thread(attrs, boost::bind(dispatcher_thread_func, this));
-    }
-    else
-    {
-        m_dispatcherthread = new boost::thread(boost::bind(dispatcher_thread_func, this));
-    }
-
-
 }
 
 WorkManagerImpl::~WorkManagerImpl()
 {
     Stop();
 
-    m_works.clear();
-    m_tasks.clear();
-    m_freelist.clear();
-
-    int count = m_workers.size();
+    int count = m_slotcount;
     for(int i=0; i<count; i++)
     {
         Worker* worker = m_workers[i];
         if(worker) delete worker;
+        m_workers[i] = NULL;
     }
 
     m_workers.clear();
 
-    if(m_dispatcherthread)
+    for(int i=0; i<ESN_WORK_SERIAL_BUCKETS; i++)
     {
-        delete m_dispatcherthread;
-        m_dispatcherthread = NULL;
+        SerialBucket& bucket = m_serialbuckets[i];
+        std::map<int, SerialQueue*>::iterator it = bucket.m_queues.begin();
+        while(it != bucket.m_queues.end())
+        {
+            delete it->second;
+            it++;
+        }
+        bucket.m_queues.clear();
     }
 
 }
@@ -423,143 +726,277 @@ WorkPtr WorkManagerImpl::GetWork(const std::string& key)
 	return work;
 }
 
-
-int WorkManagerImpl::StopDispaching()
+bool WorkManagerImpl::AddWorker()
 {
-    // lock nothing coz care nothing ...
+    // do not create threads too fast, the busy ones may be free soon
+    long long now = get_current_ms();
+    long long last = m_lastspawntime;
+    if(now - last < ESN_WORK_SPAWN_INTERVAL && now >= last) return false;
 
-    if(m_state <= 0) return m_state;
-    m_state = 0;
+    boost::unique_lock<boost::mutex> lock(m_workermutex);
 
-    m_workreq = 1;
+    if(m_state <= 0 || m_workercount >= m_maxworkercount) return false;
+    if(!m_lastspawntime.compare_exchange_strong(last, now)) return false; // someone else has just done it
 
-    m_condition.notify_one(); // just send out a signal
+    // restart a retired worker first (its queue may still have tasks)
+    int count = m_slotcount;
+    for(int i=0; i<count; i++)
+    {
+        Worker* worker = m_workers[i];
+        if(worker && !worker->IsActive())
+        {
+            m_workercount++;
+            worker->Restart();
+            return true;
+        }
+    }
 
-    if(m_dispatcherthread) m_dispatcherthread->join(); // and wait for end
+    if(count >= m_maxworkercount) return false;
 
-    m_state = -1;
-    return m_state;
+    m_workercount++;
+    m_workers[count] = new Worker(this, count, m_stacksize);
+    m_slotcount = count + 1; // publish the new slot after it is ready
 
+    return true;
 }
 
-int WorkManagerImpl::TakeBack(Worker* worker)
+bool WorkManagerImpl::RetireWorker(Worker* worker)
 {
-    if(!worker) return -1;
+    boost::unique_lock<boost::mutex> lock(m_workermutex);
+
+    if(m_state <= 0 || m_workercount <= m_minworkercount) return false;
+
+    m_workercount--;
+    worker->Retire();
+
+    return true;
+}
+
+void WorkManagerImpl::TakeBack(BufferPtr buf)
+{
+    if(m_bufmgr) m_bufmgr->TakeBack(buf);
+}
+
+int WorkManagerImpl::RunTask(WorkTask& task)
+{
+    if(task.m_serial) return RunSerialTask(task.m_serial);
 
     int ret = 0;
 
-    if(worker)
+    long long now = task.m_deadline > 0 ? get_current_ms() : 0;
+    if(now > task.m_deadline)
     {
-        boost::unique_lock<boost::mutex> lock(m_workermutex);
-        m_freelist.push_back(worker);
-        ret = m_freelist.size();
+        // it is too late, let the work know it instead of running it
+        m_expiredcount++;
+        ret = task.m_work->Drop(task.m_data, (int)(now - task.m_addtime));
     }
+    else ret = task.m_work->Run(task.m_data);
+
+    if(task.m_data->recyclable()) TakeBack(task.m_data);
+
+    return ret;
+}
+
+SerialBucket& WorkManagerImpl::GetSerialBucket(int key)
+{
+    return m_serialbuckets[((unsigned int)key) % ESN_WORK_SERIAL_BUCKETS];
+}
+
+int WorkManagerImpl::RunSerialTask(SerialQueue* serial)
+{
+    SerialBucket& bucket = GetSerialBucket(serial->m_key);
+
+    WorkTask task;
+    int priority = WORK_PRIORITY_NORMAL;
+    long long deadline = 0;
 
-    //if(ret > 0) m_dispatcher.signal();
-    if(ret > 0)
     {
-        boost::unique_lock<boost::mutex> lock(m_dispatchermutex);
-        m_workreq++;
-        m_condition.notify_one();
+        boost::unique_lock<boost::mutex> lock(bucket.m_mutex);
+        if(serial->m_tasks.empty()) return 0; // should not happen
+        task = serial->m_tasks.front();
+        serial->m_tasks.pop_front();
+        m_serialcount--;
     }
 
+    int ret = RunTask(task);
+
+    ReleaseTasks(1, task.m_bytes);
+
+    {
+        boost::unique_lock<boost::mutex> lock(bucket.m_mutex);
+        if(serial->m_tasks.empty())
+        {
+            // nothing left, remove the queue (it will be created again by next task with the key)
+            bucket.m_queues.erase(serial->m_key);
+            delete serial;
+            return ret;
+        }
+        priority = serial->m_tasks.front().m_priority;
+        deadline = serial->m_tasks.front().m_deadline;
+    }
+
+    // let the tasks waiting in the worker go first, the next one of the queue can be run by any worker
+    if(m_state > 0) ScheduleTask(WorkTask(serial, priority, deadline));
+
     return ret;
 }
 
-void WorkManagerImpl::TakeBack(BufferPtr buf)
+void WorkManagerImpl::WakeUp(bool all)
 {
-    if(m_bufmgr) m_bufmgr->TakeBack(buf);
+    boost::unique_lock<boost::mutex> lock(m_parkmutex);
+    if(all) m_parkcondition.notify_all();
+    else m_parkcondition.notify_one();
 }
 
-void WorkManagerImpl::WaitForWork()
+void WorkManagerImpl::WakeUpSome(int count)
 {
-    boost::unique_lock<boost::mutex> lock(m_dispatchermutex);
-    while(m_workreq <= 0) m_condition.wait(lock);
-    m_workreq--;
-    if(m_workreq < 0) m_workreq = 0;
+    boost::unique_lock<boost::mutex> lock(m_parkmutex);
+    for(int i=0; i<count; i++) m_parkcondition.notify_one();
 }
 
-int WorkManagerImpl::Dispatch()
+int WorkManagerImpl::GetTakeCount(bool spinning)
 {
-    while(m_state > 0)
+    // share the waiting tasks with the idle workers, so a batch will not be run one by one on a single worker
+    // (and with the workers which may be added soon, so a burst will not be kept by the busy ones)
+    int others = m_spinners + m_sleepers - (spinning ? 1 : 0);
+    if(others < 0) others = 0;
+    if(m_workercount < m_maxworkercount) others += m_maxworkercount - m_workercount;
+    int share = m_schedule.m_taskcount / (others + 1);
+    if(share < 1) share = 1;
+    if(share > ESN_WORK_BATCH_SIZE) share = ESN_WORK_BATCH_SIZE;
+    return share;
+}
+
+bool WorkManagerImpl::StealTasks(Worker* thief, std::vector<WorkTask>& tasks, int priority, int maxcount)
+{
+    int count = m_slotcount; // the queues of the retired workers are checked too
+    int start = thief ? thief->GetIndex() + 1 : 0;
+
+    for(int i=0; i<count && m_schedule.m_taskcount > 0; i++)
     {
-        WaitForWork();
+        Worker* victim = m_workers[(start + i) % count];
+        if(victim && victim != thief && victim->PopTasks(tasks, priority, maxcount, true, m_schedule) > 0) return true;
+    }
 
-        //std::cout << "Start to dispatch ... " << std::endl;
+    return false;
+}
 
-        Worker* worker = NULL;
+bool WorkManagerImpl::TakeTasks(Worker* worker, std::vector<WorkTask>& tasks, bool spinning)
+{
+    bool found = false;
 
-        if(m_state > 0)
-        {
-            boost::unique_lock<boost::mutex> locktasks(m_taskmutex);
+    // all workers are busy and the tasks are piling up (e.g. a burst came in too fast for the submitters to grow the pool),
+    // so try to add one more worker (it is still limited by ESN_WORK_SPAWN_INTERVAL)
+    if(!spinning && m_spinners == 0 && m_sleepers == 0 && m_schedule.m_taskcount >= ESN_WORK_SPAWN_BACKLOG
+       && m_workercount < m_maxworkercount) AddWorker();
+
+    int maxcount = GetTakeCount(spinning);
+
+    if(m_schedule.m_policy == 0)
+    {
+        // with strict priority, the most urgent tasks in other workers go before the ones of its own
+        int top = m_schedule.GetTopClass();
+        if(top >= 0) found = worker->PopTasks(tasks, top, maxcount, false, m_schedule) > 0 || StealTasks(worker, tasks, top, maxcount);
+    }
+
+    if(!found) found = worker->PopTasks(tasks, -1, maxcount, false, m_schedule) > 0 || StealTasks(worker, tasks, -1, maxcount);
+
+    // there are more tasks (left for the others), but nobody is looking for them, so wake up another one
+    if(found && m_spinners == 0 && m_sleepers > 0 && m_schedule.m_taskcount > 0) WakeUp();
+
+    return found;
+}
 
-            WorkPtr work;
-            BufferPtr task;
+bool WorkManagerImpl::FindTasks(Worker* worker, std::vector<WorkTask>& tasks)
+{
+    long long idlesince = 0;
 
-            if(m_works.size() > 0) work = m_works.front();
-            if(m_tasks.size() > 0) task = m_tasks.front();
+    while(m_state > 0)
+    {
+        if(TakeTasks(worker, tasks)) return true;
 
-            if(work)
+        // spin for a while, new tasks may come soon
+        bool found = false;
+        m_spinners++;
+        for(int i=0; i<ESN_WORK_SPIN_COUNT && m_state > 0; i++)
+        {
+            if(m_schedule.m_taskcount > 0)
             {
-                if(task)
-                {
-                    boost::unique_lock<boost::mutex> lockworkers(m_workermutex);
-                    if(m_freelist.size() > 0)
-                    {
-                        worker = m_freelist.front();
-                        m_freelist.pop_front();
-                    }
-                    else
-                    {
-                        int workercount = m_workers.size();
-                        if(workercount < m_maxworkercount || m_maxworkercount <= 0)
-                        {
-                            Worker* newworker = new Worker(this, m_stacksize);
-                            m_workers.push_back(newworker);
-                            worker = newworker;
-                        }
-                    }
+                found = TakeTasks(worker, tasks, true);
+                if(found) break;
+            }
+            boost::this_thread::yield();
+        }
 
-                }
+        if(found)
+        {
+            // if it was the last one looking for tasks, let a sleeping one take its place
+            if(--m_spinners == 0 && m_schedule.m_taskcount > 0 && m_sleepers > 0) WakeUp();
+            return true;
+        }
 
-                if(worker)
+        if(idlesince == 0) idlesince = get_current_ms();
+
+        // go to sleep, but check the task count again after being counted as a sleeper,
+        // so a new task will either be seen here or wake us up
+        bool timeout = false;
+        {
+            boost::unique_lock<boost::mutex> lock(m_parkmutex);
+            m_sleepers++;
+            m_spinners--;
+            while(m_schedule.m_taskcount <= 0 && m_state > 0 && !timeout)
+            {
+                int idletimeout = m_idletimeout;
+                if(idletimeout <= 0) m_parkcondition.wait(lock);
+                else
                 {
-                    worker->SetWorkTask(work, task);
-                    m_works.pop_front();
-                    m_tasks.pop_front();
+                    long long left = idlesince + idletimeout * 1000LL - get_current_ms();
+                    if(left <= 0 || !m_parkcondition.timed_wait(lock, boost::posix_time::milliseconds(left))) timeout = true;
                 }
             }
+            m_sleepers--;
         }
 
-        if(worker) worker->GoToWork();
-
-        //m_dispatcher.wait();
-        //usleep(50 * 1000);
+        if(timeout)
+        {
+            // it has been idle for long enough, end the thread if there are more workers than the minimum
+            if(RetireWorker(worker)) return false;
+            idlesince = 0;
+        }
     }
-    return m_state;
 
+    return false;
 }
 
 int WorkManagerImpl::Stop()
 {
     if(m_state <= 0) return m_state;
-    StopDispaching();
-    int count = m_workers.size();
+    m_state = 0;
+
+    {
+        // no more new workers
+        boost::unique_lock<boost::mutex> lock(m_workermutex);
+        m_state = 0;
+    }
+
+    WakeUp(true);
+
+    int count = m_slotcount;
     for(int i=0; i<count; i++)
     {
         Worker* worker = m_workers[i];
         if(worker) worker->Stop();
     }
     m_state = -1;
+
+    SetTaskLimit(0, 0, 0); // let the waiting ones go
     return m_state;
 }
 int WorkManagerImpl::Abort()
 {
     if(m_state <= 0) return m_state;
     m_state = -1;
-    if(m_dispatcherthread) m_dispatcherthread->interrupt();
-    //usleep(50 * 1000);
-    int count = m_workers.size();
+    int count = m_slotcount;
     for(int i=0; i<count; i++)
     {
         Worker* worker = m_workers[i];
@@ -576,39 +1013,330 @@ int WorkManagerImpl::GetState()
 
 int WorkManagerImpl::GetWorkerCount()
 {
-    return m_workers.size();
+    return m_workercount;
+}
+int WorkManagerImpl::GetIdleWorkerCount()
+{
+    return m_spinners + m_sleepers;
 }
 int WorkManagerImpl::GetTaskCount()
 {
-    return m_tasks.size();
+    return m_schedule.m_taskcount + m_serialcount;
+}
+long long WorkManagerImpl::GetExpiredTaskCount()
+{
+    return m_expiredcount;
 }
 
-int WorkManagerImpl::AddWorkTask(WorkPtr work, BufferPtr task)
+int WorkManagerImpl::AddWorkTask(WorkPtr work, BufferPtr task, int priority, int timeout)
 {
     if(m_state <= 0) return m_state;
 
-    int ret = 0;
+    if(!work || !task) return 0;
+
+    if(priority < 0) priority = 0;
+    if(priority >= WORK_PRIORITY_COUNT) priority = WORK_PRIORITY_COUNT - 1;
+
+    long long now = timeout > 0 ? get_current_ms() : 0;
+    long long deadline = timeout > 0 ? now + timeout : 0;
+
+    WorkTask newtask(work, task, priority, deadline);
+    AdmitTasks(1, newtask.m_bytes);
+
+    return ScheduleTask(newtask);
+
+}
+
+int WorkManagerImpl::AddWorkTasks(WorkPtr work, std::vector<BufferPtr>& workdata, int priority, int timeout)
+{
+    if(m_state <= 0) return m_state;
+
+    if(!work || workdata.empty()) return 0;
+
+    if(priority < 0) priority = 0;
+    if(priority >= WORK_PRIORITY_COUNT) priority = WORK_PRIORITY_COUNT - 1;
+
+    long long now = timeout > 0 ? get_current_ms() : 0;
+    long long deadline = timeout > 0 ? now + timeout : 0;
+
+    std::vector<WorkTask> tasks;
+    tasks.reserve(workdata.size());
+
+    long long bytes = 0;
+    int count = workdata.size();
+    for(int i=0; i<count; i++)
+    {
+        if(!workdata[i]) continue;
+        tasks.push_back(WorkTask(work, workdata[i], priority, deadline));
+        bytes += tasks.back().m_bytes;
+    }
+
+    if(tasks.empty()) return 0;
+
+    AdmitTasks(tasks.size(), bytes);
+
+    return ScheduleTasks(&tasks[0], tasks.size());
+
+}
+
+int WorkManagerImpl::AddSerialWorkTask(int key, WorkPtr work, BufferPtr task, int priority, int timeout)
+{
+    if(m_state <= 0) return m_state;
+
+    if(!work || !task) return 0;
+
+    if(priority < 0) priority = 0;
+    if(priority >= WORK_PRIORITY_COUNT) priority = WORK_PRIORITY_COUNT - 1;
+
+    long long now = timeout > 0 ? get_current_ms() : 0;
+    long long deadline = timeout > 0 ? now + timeout : 0;
+
+    SerialBucket& bucket = GetSerialBucket(key);
+
+    SerialQueue* serial = NULL;
+
+    {
+        boost::unique_lock<boost::mutex> lock(bucket.m_mutex);
+
+        std::map<int, SerialQueue*>::iterator it = bucket.m_queues.find(key);
+        if (it != bucket.m_queues.end()) serial = it->second;
+        else
+        {
+            serial = new SerialQueue(key);
+            bucket.m_queues.insert(std::map<int, SerialQueue*>::value_type(key, serial));
+        }
+
+        serial->m_tasks.push_back(WorkTask(work, task, priority, deadline));
+        serial->m_tasks.back().m_addtime = now;
+        m_serialcount++;
+
+        AdmitTasks(1, serial->m_tasks.back().m_bytes);
+
+        // the queue is being run already, the new task will be run after the ones before it
+        if(serial->m_running) return GetTaskCount();
+
+        serial->m_running = true;
+    }
+
+    return ScheduleTask(WorkTask(serial, priority, deadline));
+
+}
+
+int WorkManagerImpl::AddSerialWorkTasks(int key, WorkPtr work, std::vector<BufferPtr>& workdata, int priority, int timeout)
+{
+    if(m_state <= 0) return m_state;
+
+    if(!work || workdata.empty()) return 0;
+
+    if(priority < 0) priority = 0;
+    if(priority >= WORK_PRIORITY_COUNT) priority = WORK_PRIORITY_COUNT - 1;
+
+    long long now = timeout > 0 ? get_current_ms() : 0;
+    long long deadline = timeout > 0 ? now + timeout : 0;
+
+    SerialBucket& bucket = GetSerialBucket(key);
+
+    SerialQueue* serial = NULL;
 
-    if(m_state > 0)
     {
-        boost::unique_lock<boost::mutex> locktasks(m_taskmutex);
-        //printf("\nBIND: %d - %d\n", (int)task.get(), (int)task.use_count());
-        m_works.push_back(work);
-        m_tasks.push_back(task);
-        //printf("\nBIND: %d - %d\n", (int)task.get(), (int)task.use_count());
-        ret = m_tasks.size();
+        boost::unique_lock<boost::mutex> lock(bucket.m_mutex);
+
+        std::map<int, SerialQueue*>::iterator it = bucket.m_queues.find(key);
+        if (it != bucket.m_queues.end()) serial = it->second;
+        else
+        {
+            serial = new SerialQueue(key);
+            bucket.m_queues.insert(std::map<int, SerialQueue*>::value_type(key, serial));
+        }
+
+        int added = 0;
+        long long bytes = 0;
+        int count = workdata.size();
+        for(int i=0; i<count; i++)
+        {
+            if(!workdata[i]) continue;
+            serial->m_tasks.push_back(WorkTask(work, workdata[i], priority, deadline));
+            serial->m_tasks.back().m_addtime = now;
+            bytes += serial->m_tasks.back().m_bytes;
+            added++;
+        }
+        m_serialcount += added;
+
+        if(added > 0) AdmitTasks(added, bytes);
+
+        // the queue is being run already (or nothing is added)
+        if(serial->m_running || serial->m_tasks.empty())
+        {
+            if(serial->m_tasks.empty())
+            {
+                bucket.m_queues.erase(key);
+                delete serial;
+            }
+            return GetTaskCount();
+        }
+
+        serial->m_running = true;
     }
 
-    //if(ret > 0) m_dispatcher.signal();
-    if(ret > 0)
+    return ScheduleTask(WorkTask(serial, priority, deadline));
+
+}
+
+int WorkManagerImpl::ScheduleTask(const WorkTask& task)
+{
+    return ScheduleTasks(&task, 1);
+}
+
+int WorkManagerImpl::ScheduleTasks(const WorkTask* tasks, int count)
+{
+    // a worker puts new tasks into its own queue, others spread them over all workers
+    Worker* worker = current_worker.get();
+    if(!worker || worker->GetManager() != this)
     {
-        boost::unique_lock<boost::mutex> lock(m_dispatchermutex);
-        m_workreq++;
-        m_condition.notify_one();
+        int count = m_slotcount;
+        if(count <= 0) return 0;
+        unsigned int next = m_nextworker++;
+        worker = m_workers[next % count];
+
+        // skip the retired ones (if the worker retires right now, its tasks will be stolen by others)
+        for(int i=1; i<count && !worker->IsActive(); i++) worker = m_workers[(next + i) % count];
     }
 
-    return ret;
+    worker->PushTasks(tasks, count, m_schedule);
+
+    int ret = m_schedule.m_taskcount;
+
+    // wake up enough sleeping workers for the new tasks (the spinning ones will take some of them),
+    // or create a new one if all are busy and the tasks begin to pile up
+    int spinners = m_spinners;
+    int sleepers = m_sleepers;
+    if(sleepers > 0 && count > spinners) WakeUpSome(count - spinners < sleepers ? count - spinners : sleepers);
+    else if(spinners == 0 && sleepers == 0 && ret >= ESN_WORK_SPAWN_BACKLOG && m_workercount < m_maxworkercount) AddWorker();
+
+    return ret > 0 ? ret : 1;
+
+}
+
+int WorkManagerImpl::GetIdleTimeout()
+{
+    return m_idletimeout;
+}
+void WorkManagerImpl::SetIdleTimeout(int seconds)
+{
+    m_idletimeout = seconds > 0 ? seconds : 0;
+    WakeUp(true); // let the sleeping ones check the new timeout
+}
+
+void WorkManagerImpl::SetSchedulingPolicy(int policy)
+{
+    m_schedule.m_policy = policy == 0 ? 0 : 1;
+}
+
+void WorkManagerImpl::SetPriorityWeight(int priority, int weight)
+{
+    if(priority < 0 || priority >= WORK_PRIORITY_COUNT) return;
+    m_schedule.m_weights[priority] = weight > 0 ? weight : 1;
+}
+
+void WorkManagerImpl::AdmitTasks(int count, long long bytes)
+{
+    m_loadcount += count;
+    m_loadbytes += bytes;
 
+    if(m_overloaded || !IsOverLimit()) return;
+
+    boost::unique_lock<boost::mutex> lock(m_admissionmutex);
+    if(IsOverLimit()) m_overloaded = true;
+}
+
+void WorkManagerImpl::ReleaseTasks(int count, long long bytes)
+{
+    m_loadcount -= count;
+    m_loadbytes -= bytes;
+
+    if(!m_overloaded || !IsUnderResumeLimit()) return;
+
+    std::vector<AdmissionCallback> waiters;
+
+    {
+        boost::unique_lock<boost::mutex> lock(m_admissionmutex);
+        if(!m_overloaded || !IsUnderResumeLimit()) return;
+        m_overloaded = false;
+        waiters.swap(m_admissionwaiters);
+    }
+
+    int total = waiters.size();
+    for(int i=0; i<total; i++)
+    {
+        try { waiters[i](); }
+        catch(...) { LogManager::Warning("Exception found in the admission callback."); }
+    }
+}
+
+bool WorkManagerImpl::IsOverLimit() const
+{
+    return (m_maxloadcount > 0 && m_loadcount >= m_maxloadcount)
+        || (m_maxloadbytes > 0 && m_loadbytes >= m_maxloadbytes);
+}
+
+bool WorkManagerImpl::IsUnderResumeLimit() const
+{
+    return (m_maxloadcount <= 0 || m_loadcount <= m_resumeloadcount)
+        && (m_maxloadbytes <= 0 || m_loadbytes <= m_resumeloadbytes);
+}
+
+long long WorkManagerImpl::GetTaskLoad(int loadtype)
+{
+    if(loadtype == 1) return m_loadcount;
+    else if(loadtype == 2) return m_loadbytes;
+
+    return 0;
+}
+
+long long WorkManagerImpl::GetTaskLimit(int limittype)
+{
+    if(limittype == 1) return m_maxloadcount;
+    else if(limittype == 2) return m_maxloadbytes;
+
+    return 0;
+}
+
+void WorkManagerImpl::SetTaskLimit(int limittype, long long maxvalue, long long resumevalue)
+{
+    if(maxvalue < 0) maxvalue = 0;
+    if(resumevalue <= 0 || resumevalue > maxvalue) resumevalue = maxvalue / 2;
+
+    {
+        boost::unique_lock<boost::mutex> lock(m_admissionmutex);
+
+        if(limittype == 0 || limittype == 1)
+        {
+            m_maxloadcount = maxvalue;
+            m_resumeloadcount = resumevalue;
+        }
+        if(limittype == 0 || limittype == 2)
+        {
+            m_maxloadbytes = maxvalue;
+            m_resumeloadbytes = resumevalue;
+        }
+
+        if(!m_overloaded && IsOverLimit()) m_overloaded = true;
+    }
+
+    ReleaseTasks(0, 0); // the waiting ones may go now
+}
+
+bool WorkManagerImpl::IsOverloaded()
+{
+    return m_overloaded;
+}
+
+bool WorkManagerImpl::WaitForAdmission(const AdmissionCallback& callback)
+{
+    boost::unique_lock<boost::mutex> lock(m_admissionmutex);
+    if(!m_overloaded) return true;
+    m_admissionwaiters.push_back(callback);
+    return false;
 }
 
 void WorkManagerImpl::SetBufferManager(BufferManagerPtr manager)
@@ -621,4 +1349,3 @@ esnlib::WorkManagerPtr esnlib::CreateWorkManager(int minworkercount, int maxwork
     esnlib::WorkManagerPtr mgr(new WorkManagerImpl(minworkercount, maxworkercount, workstack));
     return mgr;
 }
-
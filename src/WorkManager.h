@@ -32,14 +32,72 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef _ESN_WORKMANAGER_H_
 #define _ESN_WORKMANAGER_H_
 
+#include <vector>
+
+#include <boost/function.hpp>
+
 #include "Work.h"
 #include "Buffer.h"
 #include "BufferManager.h"
 
+#ifndef ESN_WORK_SPIN_COUNT
+#define ESN_WORK_SPIN_COUNT 64
+#endif
+
+#ifndef ESN_WORK_BATCH_SIZE
+#define ESN_WORK_BATCH_SIZE 16
+#endif
+
+#ifndef ESN_WORK_DEFAULT_DUE_TIME
+#define ESN_WORK_DEFAULT_DUE_TIME 1000
+#endif
+
+#ifndef ESN_WORK_IDLE_TIMEOUT
+#define ESN_WORK_IDLE_TIMEOUT 60
+#endif
+
+#ifndef ESN_WORK_SPAWN_INTERVAL
+#define ESN_WORK_SPAWN_INTERVAL 10
+#endif
+
+#ifndef ESN_WORK_SPAWN_BACKLOG
+#define ESN_WORK_SPAWN_BACKLOG 2
+#endif
+
+#ifndef ESN_WORK_SERIAL_BUCKETS
+#define ESN_WORK_SERIAL_BUCKETS 64
+#endif
+
 namespace esnlib
 {
 
+/// Priority classes of the work tasks (a smaller value is more urgent)
+enum WorkPriority
+{
+    WORK_PRIORITY_HIGH = 0,
+    WORK_PRIORITY_NORMAL = 1,
+    WORK_PRIORITY_LOW = 2,
+
+    WORK_PRIORITY_COUNT = 3
+};
+
+/// The callback function to resume something paused by the admission control of the work manager
+typedef boost::function<void()> AdmissionCallback;
+
 /// Work Manager class (interface), it will work like a thread pool
+///
+/// Every worker has its own task queue and takes up to ESN_WORK_BATCH_SIZE tasks from it at a time,
+/// an idle worker will steal (half of the) tasks from the others, and it will spin for a while (ESN_WORK_SPIN_COUNT rounds) before going to sleep.
+/// The tasks are scheduled by their priority classes (see WorkPriority and SetSchedulingPolicy()),
+/// and in a class, the tasks with deadlines are run earliest-deadline-first (a task without deadline is treated as
+/// due in ESN_WORK_DEFAULT_DUE_TIME milliseconds), the ones which could not start before their deadlines will be
+/// dropped (see Work::Drop()).
+/// When all workers are busy and ESN_WORK_SPAWN_BACKLOG tasks are waiting, a new worker will be added
+/// (at most one per ESN_WORK_SPAWN_INTERVAL milliseconds), and the workers idle for longer than
+/// the idle timeout will retire until only the minimum number is left.
+/// The tasks added and not finished yet are counted (with the size of their data, see Buffer::datasize()),
+/// when they reach the limit (see SetTaskLimit()) the work manager is overloaded, and the sessions waiting for
+/// admission (see WaitForAdmission()) will be resumed when the load falls below the low watermark
 class WorkManager
 {
 
@@ -65,20 +123,119 @@ public:
 
     /// Get total number of the workers(threads)
     ///
-    /// @return The total number of the workers(threads)
+    /// @return The total number of the workers(threads) running now
     virtual int GetWorkerCount() = 0;
 
+    /// Get number of the idle workers
+    ///
+    /// @return The number of the workers(threads) waiting for tasks
+    virtual int GetIdleWorkerCount() = 0;
+
     /// Get total number of the tasks
     ///
     /// @return The total number of the tasks
     virtual int GetTaskCount() = 0;
 
+    /// Get number of the tasks dropped for being expired (since the work manager was created)
+    ///
+    /// @return The number of the expired tasks
+    virtual long long GetExpiredTaskCount() = 0;
+
+    /// Get the load of the work manager (the tasks added and not finished yet, the running ones included)
+    ///
+    /// @param loadtype The load type: 1 for number of the tasks, 2 for total bytes of their data
+    /// @return The load value
+    virtual long long GetTaskLoad(int loadtype) = 0;
+
+    /// Get the limit of the load (see GetTaskLoad())
+    ///
+    /// @param limittype The limit type: 1 for number of the tasks, 2 for total bytes of their data
+    /// @return The limit value (0 means no limit)
+    virtual long long GetTaskLimit(int limittype) = 0;
+
+    /// Set the limit of the load (see GetTaskLoad()), the work manager is overloaded when the load reaches the limit,
+    /// and it is not overloaded any more when the load falls below the low watermark
+    /// (new tasks are still accepted when it is overloaded, it is up to the callers to wait, see WaitForAdmission())
+    ///
+    /// @param limittype The limit type: 1 for number of the tasks, 2 for total bytes of their data, 0 for both
+    /// @param maxvalue The limit value (0 means no limit, it is the default)
+    /// @param resumevalue The low watermark ("0" means half of the limit)
+    virtual void SetTaskLimit(int limittype, long long maxvalue, long long resumevalue = 0) = 0;
+
+    /// Check whether the work manager is overloaded (see SetTaskLimit())
+    ///
+    /// @return Return true if the work manager is overloaded
+    virtual bool IsOverloaded() = 0;
+
+    /// Wait until the work manager is not overloaded
+    ///
+    /// @param callback The callback function, it will be called (in a worker thread) when the load falls below the low watermark
+    /// @return Return true if the work manager is not overloaded (and the callback will not be called)
+    virtual bool WaitForAdmission(const AdmissionCallback& callback) = 0;
+
     /// Add a new work task
     ///
     /// @param work The work object, which will provide the callback function for the threads
     /// @param workdata The working data for the task
+    /// @param priority The priority class of the task (see WorkPriority)
+    /// @param timeout How long the task can wait in the queue (in milliseconds, counted from now, 0 means no limit)
+    /// @return The total number of the tasks
+    virtual int AddWorkTask(WorkPtr work, BufferPtr workdata, int priority = WORK_PRIORITY_NORMAL, int timeout = 0) = 0;
+
+    /// Add new work tasks together (with one lock and one wakeup)
+    ///
+    /// @param work The work object, which will provide the callback function for the threads
+    /// @param workdata The working data of the tasks
+    /// @param priority The priority class of the tasks (see WorkPriority)
+    /// @param timeout How long the tasks can wait in the queue (in milliseconds, counted from now, 0 means no limit)
+    /// @return The total number of the tasks
+    virtual int AddWorkTasks(WorkPtr work, std::vector<BufferPtr>& workdata, int priority = WORK_PRIORITY_NORMAL, int timeout = 0) = 0;
+
+    /// Add a new work task into a serial queue
+    ///
+    /// The tasks with the same key will be run one by one in the order they were added (on any worker),
+    /// while the tasks with different keys can be run at the same time
+    ///
+    /// @param key The key of the serial queue (a session id for example)
+    /// @param work The work object, which will provide the callback function for the threads
+    /// @param workdata The working data for the task
+    /// @param priority The priority class of the task (see WorkPriority), it does not change the order of the queue
+    /// @param timeout How long the task can wait (in milliseconds, counted from now, 0 means no limit)
     /// @return The total number of the tasks
-    virtual int AddWorkTask(WorkPtr work, BufferPtr workdata) = 0;
+    virtual int AddSerialWorkTask(int key, WorkPtr work, BufferPtr workdata, int priority = WORK_PRIORITY_NORMAL, int timeout = 0) = 0;
+
+    /// Add new work tasks into a serial queue together (they will be run in the order of the vector)
+    ///
+    /// @param key The key of the serial queue (a session id for example)
+    /// @param work The work object, which will provide the callback function for the threads
+    /// @param workdata The working data of the tasks
+    /// @param priority The priority class of the tasks (see WorkPriority), it does not change the order of the queue
+    /// @param timeout How long the tasks can wait (in milliseconds, counted from now, 0 means no limit)
+    /// @return The total number of the tasks
+    virtual int AddSerialWorkTasks(int key, WorkPtr work, std::vector<BufferPtr>& workdata, int priority = WORK_PRIORITY_NORMAL, int timeout = 0) = 0;
+
+    /// Get the idle timeout of the workers
+    ///
+    /// @return The idle timeout in seconds (0 means never)
+    virtual int GetIdleTimeout() = 0;
+
+    /// Set the idle timeout of the workers, a worker idle for longer than that will end its thread
+    /// (but the work manager will keep the minimum number of the workers)
+    ///
+    /// @param seconds The idle timeout in seconds (0 means never, it is ESN_WORK_IDLE_TIMEOUT by default)
+    virtual void SetIdleTimeout(int seconds) = 0;
+
+    /// Set the scheduling policy of the priority classes
+    ///
+    /// @param policy 0 for strict priority (a less urgent task will wait until no more urgent one is waiting),
+    ///               1 for weighted-fair (every class gets its share by weight, it is the default policy)
+    virtual void SetSchedulingPolicy(int policy) = 0;
+
+    /// Set the weight of a priority class, it is used by the weighted-fair policy
+    ///
+    /// @param priority The priority class (see WorkPriority)
+    /// @param weight How many tasks of the class can be taken in one round (16, 4 and 1 by default)
+    virtual void SetPriorityWeight(int priority, int weight) = 0;
 
     /// Set Buffer Manager (memory pool)
     ///